@@ -0,0 +1,89 @@
+//
+// arena.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem a arena de memória dos buffers que dependem da
+// configuração (as janelas das medianas, os frames dos encoders e o
+// buffer da telemetria). A arena começa no fim do .bss (__heap_start)
+// e cresce em direção à pilha; nada é liberado, e tudo é alocado uma
+// vez só, na inicialização, então não há fragmentação
+//
+// Com a configuração padrão as entradas usam 132 bytes, contra os 748
+// do pior caso (31 amostras e 32 frames). O que não for alocado fica
+// para a pilha. O size.py mostra a ocupação de cada configuração
+//
+// Aqui também fica a medição da pilha: antes do main, toda a memória
+// acima do .bss é pintada com STACK_PAINT, e stack_scan_step() procura,
+// de baixo para cima e um pedaço por frame, o primeiro byte que não é
+// mais a pintura. Abaixo dele a pilha nunca chegou, então a menor
+// distância já vista entre ele e a arena é a folga mínima da memória
+//
+
+#include "default.h"
+
+// Espaço que sempre fica livre abaixo da pilha atual, para os interrupts
+// e as chamadas do loop principal
+#define ARENA_STACK_RESERVE 256
+
+#define STACK_PAINT 0xC5
+#define STACK_SCAN_CHUNK 64
+
+extern uint8_t __heap_start;
+static uint8_t *arena_top = &__heap_start;
+
+static uint8_t *scan_ptr = 0;
+static memory_stats_struct stats = { 0, 0, 0, 0xFFFF };
+
+// Roda no .init3, antes do .data e do .bss serem inicializados: só pode usar
+// registradores e a pilha. Deixa 16 bytes livres abaixo da pilha atual
+void stack_paint()
+{
+	uint8_t *end = (uint8_t*)(SP - 16);
+	for (uint8_t *p = &__heap_start; p < end; p++)
+		*p = STACK_PAINT;
+}
+
+// Chamada a cada frame: continua a varredura, STACK_SCAN_CHUNK bytes por vez
+// (uns 20 us), e atualiza as estatísticas no fim de cada passada
+void stack_scan_step()
+{
+	if (scan_ptr < arena_top) scan_ptr = arena_top;
+	
+	uint8_t *end = (uint8_t*)SP;
+	for (uint8_t i = 0; i < STACK_SCAN_CHUNK; i++, scan_ptr++)
+		if (scan_ptr >= end || *scan_ptr != STACK_PAINT)
+		{
+			uint16_t gap = scan_ptr - arena_top;
+			if (gap < stats.free_min) stats.free_min = gap;
+			
+			uint16_t stack = RAMEND + 1 - (uint16_t)scan_ptr;
+			if (stack > stats.stack_max) stats.stack_max = stack;
+			
+			scan_ptr = arena_top;
+			break;
+		}
+}
+
+const memory_stats_struct* memory_get_stats()
+{
+	stats.static_bytes = (uint16_t)&__heap_start - RAMSTART;
+	stats.arena_bytes = arena_used();
+	return &stats;
+}
+
+// Retorna 0 se não houver espaço
+void* arena_alloc(uint16_t size)
+{
+	uint8_t *ptr = arena_top;
+	if ((uint16_t)(SP - (uint16_t)ptr) < size + ARENA_STACK_RESERVE) return 0;
+	arena_top += size;
+	return ptr;
+}
+
+uint16_t arena_used()
+{
+	return arena_top - &__heap_start;
+}
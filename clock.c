@@ -0,0 +1,74 @@
+//
+// clock.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem a base de tempo do programa. O Timer1 (ver main.c)
+// conta em ticks de 0,5 us e dá overflow a cada 1024 us; os overflows
+// são contados aqui, em 24 bits (r7 mais um contador de 16 bits), o que
+// dá um relógio em microssegundos que só dá a volta nos 32 bits
+// (uns 71 minutos). Todo módulo que precisar de tempo deve usar as
+// funções daqui, e não ler o TCNT1 diretamente
+//
+
+#include "default.h"
+
+#define overflow_count "r7"
+
+FIXED_REGISTER(overflow_count_v, overflow_count);
+static volatile uint16_t overflow_count_hi = 0;
+
+// Metade do período do Timer1: se o TCNT1 está abaixo disso e a flag de
+// overflow está ligada, o overflow aconteceu mas ainda não foi contado
+#define HALF_PERIOD 1024
+
+// overflow do timer1: contagem de tempo e liberação do SCHED_FRAME
+ISR (TIMER1_OVF_vect)
+{
+	LOAD_ISR();
+	if (++overflow_count_v == 0) overflow_count_hi++;
+	if (overflow_count_v % 8 == 0)
+	{
+		// O frame anterior ainda não começou: essa liberação se perde
+		if (flags & EXECUTE_ENC) sched_skips[SCHED_FRAME]++;
+		flags |= EXECUTE_ENC;
+	}
+}
+
+void clock_init()
+{
+	CLEAR_FIXED_REGISTER(overflow_count_v, overflow_count);
+	overflow_count_hi = 0;
+}
+
+// Converte uma foto do TCNT1, de r7 e do TIFR1 (tirada nessa ordem e com os
+// interrupts desligados) em ticks de 0,5 us
+uint16_t clock_ticks_raw(uint16_t tcnt, uint8_t ovf, uint8_t tifr)
+{
+	if ((tifr & _BV(TOV1)) && tcnt < HALF_PERIOD) ovf++;
+	return tcnt | ((uint16_t)ovf << 11);
+}
+
+// Só pode ser chamada com os interrupts desligados (dentro de um ISR)
+uint16_t clock_ticks()
+{
+	uint16_t tcnt = TCNT1;
+	uint8_t ovf = overflow_count_v;
+	return clock_ticks_raw(tcnt, ovf, TIFR1);
+}
+
+uint32_t clock_now_us()
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t tcnt = TCNT1;
+	uint8_t lo = overflow_count_v;
+	uint16_t hi = overflow_count_hi;
+	if ((TIFR1 & _BV(TOV1)) && tcnt < HALF_PERIOD)
+		if (++lo == 0) hi++;
+	SREG = sreg;
+
+	return ((uint32_t)hi << 18) | ((uint32_t)lo << 10) | (tcnt >> 1);
+}
@@ -11,12 +11,23 @@ cfgs = {
 	"right-kp":             [3, 2, 256.0, 0.0, 256.0, lambda _: True],
 	"right-ki":             [4, 2, 256.0, 0.0, 256.0, lambda _: True],
 	"right-kd":             [5, 2, 256.0, 0.0, 256.0, lambda _: True],
-	"enc-frames":           [6, 1, 1.0, 0.0, 32.0, lambda x: int(x) == x],
-	"recv-samples":         [7, 1, 1.0, 0.0, 31.0, lambda x: int(x) == x and int(x) % 2 == 1],
+	"enc-frames":           [6, 1, 1.0, 1.0, 32.0, lambda x: int(x) == x],
+	"recv-samples":         [7, 1, 1.0, 1.0, 31.0, lambda x: int(x) == x and int(x) % 2 == 1],
 	"left-reverse":         [8, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
 	"right-reverse":        [9, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
 	"esc-reverse":          [10, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
-	"esc-calibration-mode": [11, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x]
+	"esc-calibration-mode": [11, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
+	"enc-quadrature":       [12, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
+	"enc-estimator":        [13, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x],
+	"recv-timeout":         [14, 1, 1.0, 25.0, 255.0, lambda x: int(x) == x],
+	"recv-mode":            [15, 1, 1.0, 0.0, 4.0, lambda x: int(x) == x],
+	"recv-filter":          [16, 2, 1.0, 0.0, 1023.0, lambda x: int(x) == x],
+	"control-period":       [17, 2, 1.0, 1000.0, 10000.0, lambda x: int(x) == x],
+	"pid-mode":             [18, 1, 1.0, 0.0, 2.0, lambda x: int(x) == x],
+	"pid-limit":            [19, 1, 1.0, 1.0, 250.0, lambda x: int(x) == x],
+	"pid-kaw":              [20, 2, 256.0, 0.0, 256.0, lambda _: True],
+	"pid-d-shift":          [21, 1, 1.0, 0.0, 7.0, lambda x: int(x) == x],
+	"feedforward":          [22, 1, 1.0, 0.0, 1.0, lambda x: int(x) == x]
 }
 write_offset = 0x30
 ack = 0xac
@@ -39,6 +50,73 @@ def comm(ser, cmd):
 	sz = ord(req)
 	return map(ord, ser.read(sz))
 
+# A variável n é lida com o byte n e escrita com write_offset + n: de 16 em
+# diante isso já dá o nibble de cima mais 1 que o config.c espera (0x10+(n-16)
+# na leitura e 0x40+(n-16) na escrita)
+def read_cmd(cfg):
+	return cfg
+
+def write_cmd(cfg):
+	return write_offset + cfg
+
+# Telemetria: funciona com o robô rodando, sem o handshake
+telemetry_recv_stats = 0x01
+telemetry_sched_stats = 0x02
+telemetry_load = 0x03
+telemetry_memory = 0x04
+recv_stats_fields = ["aceitos", "rejeitados", "perdidos", "jitter (us)", "período (us)"]
+sched_tasks = ["controle", "frame", "receptor", "telemetria"]
+sched_stats_fields = ["liberações", "CPU total", "perdidas", "estouros", "acima orç.", "adiadas", "atraso máx", "atraso méd", "exec máx"]
+
+def telemetry(ser, query):
+	ser.write(chr(query))
+	req = ser.read()
+	if req == '':
+		raise serial.SerialException("timeout occured!")
+	rep = map(ord, ser.read(ord(req)))
+	if len(rep) < 1 or rep[0] != query:
+		raise serial.SerialException("resposta inválida!")
+	return rep[1:]
+
+def print_recv_stats(ser):
+	rep = telemetry(ser, telemetry_recv_stats)
+	print "Canal", ' '.join(map(lambda f: f.rjust(12), recv_stats_fields))
+	for ch in range(5):
+		vals = [bytestoint(rep[10*ch+2*i:10*ch+2*i+2], 2) for i in range(5)]
+		vals[3] = vals[3] / 32.0 # x16, em ticks de 0,5 us
+		print str(ch).rjust(5), ' '.join(map(lambda v: str(v).rjust(12), vals))
+
+def print_sched_stats(ser):
+	rep = telemetry(ser, telemetry_sched_stats)
+	print "Tarefa  ", ' '.join(map(lambda f: f.rjust(12), sched_stats_fields)), "(tempos em us)"
+	for t in range(len(sched_tasks)):
+		base = 22*t
+		vals = [bytestoint(rep[base+4*i:base+4*i+4], 4) for i in range(2)] + \
+			[bytestoint(rep[base+8+2*i:base+10+2*i], 2) for i in range(7)]
+		vals[7] = vals[7] / 16.0
+		print sched_tasks[t].ljust(8), ' '.join(map(lambda v: str(v).rjust(12), vals))
+
+def print_load(ser):
+	rep = telemetry(ser, telemetry_load)
+	vals = [bytestoint(rep[2*i:2*i+2], 2) for i in range(5)]
+	print "Carga da CPU na janela de", vals[4], "ms:"
+	print "  ocioso:     %5.1f%%" % (vals[0] / 10.0)
+	print "  interrupts: %5.1f%%" % (vals[1] / 10.0)
+	print "  tarefas:    %5.1f%%" % (vals[2] / 10.0)
+	print "  pico (tarefas + interrupts): %5.1f%%" % (vals[3] / 10.0)
+
+def print_memory(ser):
+	rep = telemetry(ser, telemetry_memory)
+	vals = [bytestoint(rep[2*i:2*i+2], 2) for i in range(4)]
+	print "SRAM (bytes):"
+	print "  estática (.data + .bss): ", vals[0]
+	print "  arena:                   ", vals[1]
+	print "  pilha (máximo já visto): ", vals[2]
+	if vals[3] == 0xFFFF:
+		print "  folga mínima:             ainda não medida"
+	else:
+		print "  folga mínima:            ", vals[3]
+
 def bytestoint(arr, sz):
 	arr.reverse()
 	num = 0
@@ -60,9 +138,21 @@ port = sys.argv[1]
 baud = 19200
 
 if len(sys.argv) < 2:
-	print "Uso:", sys.argv[0], "<port>"
+	print "Uso:", sys.argv[0], "<port> [recv-stats|sched-stats|load|memory]"
 	sys.exit(-1)
 
+if len(sys.argv) >= 3 and sys.argv[2] in ["recv-stats", "sched-stats", "load", "memory"]:
+	try:
+		with serial.Serial(port, baud, timeout=2.0) as ser:
+			if sys.argv[2] == "recv-stats": print_recv_stats(ser)
+			elif sys.argv[2] == "sched-stats": print_sched_stats(ser)
+			elif sys.argv[2] == "load": print_load(ser)
+			else: print_memory(ser)
+	except serial.SerialException as e:
+		print "An error occured:", e
+		sys.exit(-1)
+	sys.exit(0)
+
 try:
 	with serial.Serial(port, baud, timeout=2.0) as ser:
 		ser.write('\x55')
@@ -77,7 +167,7 @@ try:
 			if len(cmd) >= 2 and cmd[0] == "read":
 				if cfgs.has_key(cmd[1]):
 					cfg = cfgs[cmd[1]]
-					rep = comm(ser, [cfg[0]])
+					rep = comm(ser, [read_cmd(cfg[0])])
 					
 					if len(rep) >= 1 + cfg[1] and rep[0] == ack:
 						param = bytestoint(rep[1:], cfg[1]) / cfg[2]
@@ -91,7 +181,7 @@ try:
 					cfg = cfgs[cmd[1]]
 					param = float(cmd[2])
 					if param >= cfg[3] and param <= cfg[4] and cfg[5](param):
-						rep = comm(ser, [write_offset | cfg[0]]
+						rep = comm(ser, [write_cmd(cfg[0])]
 							+ inttobytes(int(param * cfg[2]), cfg[1]))
 						if len(rep) >= 1 and rep[0] == ack:
 							print "Escrita efetuada com sucesso!"
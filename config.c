@@ -10,7 +10,6 @@
 //
 
 #include "default.h"
-#include <avr/pgmspace.h>
 
 #define ACK 0xAC
 #define ERROR_INVALID_COMMAND 0xE0
@@ -21,68 +20,39 @@
 
 #define READ_CHUNK 0x00
 #define WRITE_CHUNK 0x30
+// As variáveis de 16 em diante usam o nibble de cima mais 1
+#define READ_CHUNK_HIGH 0x10
+#define WRITE_CHUNK_HIGH 0x40
 #define FINISH_CMD 0xFF
 
 #define MAX_BUFFER_LENGTH 8
 
-#define EEMEM __attribute__((section(".eeprom")))
+// Um pouco mais que um frame do receptor PWM (20 ms)
+#define RECV_TIMEOUT_MIN 25
+
+// Versão do formato da config_struct na EEPROM: muda sempre que um campo é
+// acrescentado ou mudado. Uma EEPROM gravada por outra versão do firmware (ou
+// apagada) não é lida, e vale a configuração padrão até a próxima gravação
+#define CONFIG_VERSION 2
 
 // Força o endereço 0 a não ser utilizado (ATMEL não recomenda)
 uint8_t EEMEM force_offset[4] __attribute__((used));
 config_struct EEMEM eeprom_configs[3];
 uint8_t EEMEM eeprom_check[3];
+uint8_t EEMEM eeprom_version;
 
-static config_struct configs;
-const config_struct PROGMEM default_config = { 0x0100, 0x0000, 0x0000, 0x0100, 0x0000, 0x0000, 8, 5, 0, 0, 0, 0 };
-
-// Funções para leitura e escrita de EEPROM
-void read_eeprom(void* dst, const void* src, uint8_t sz)
-{
-	uint8_t* cdst = (uint8_t*)dst;
-	const uint8_t* csrc = (const uint8_t*)src;
-
-	for (uint8_t i = 0; i < sz; i++)
-	{
-		while (EECR & _BV(EEPE));   // Espera o bit EEPE ir a 0
-		EEAR = (uintptr_t)csrc+i;   // Define o endereço de leitura
-		EECR |= _BV(EERE);          // Comanda a leitura da EEPROM
-		cdst[i] = EEDR;             // Guarda o byte lido na SRAM
-	}
-}
-
-void update_eeprom(void* dst, const void* src, uint8_t sz)
-{
-	uint8_t* cdst = (uint8_t*)dst;
-	const uint8_t* csrc = (const uint8_t*)src;
-
-	for (uint8_t i = 0; i < sz; i++)
-	{
-		wdt_reset();
-		while (EECR & _BV(EEPE));   // Espera o bit EEPE ir a 0
-		EEAR = (uintptr_t)cdst+i;   // Endereço de escrita
-		
-		EECR |= _BV(EERE);          // Byte para comparação
-		uint8_t byte = EEDR;
-		
-		if (csrc[i] != byte)
-		{
-			EEAR = (uintptr_t)cdst+i;
-			EEDR = csrc[i];           // Byte a ser escrito
-			EECR |= _BV(EEMPE);       // "Desativa" a proteção da escrita
-			EECR |= _BV(EEPE);        // Comanda a escrita
-		}
-	}
-}
+config_struct configs;
+const config_struct PROGMEM default_config = { 0x0100, 0x0000, 0x0000, 0x0100, 0x0000, 0x0000, 8, 5, 0, 0, 0, 0, 0, 0, 100, 0, 0, 8192, 0, 250, 0x0100, 2, 0 };
 
 // memcpy
 void* memcpy(void* dst, const void* src, size_t size);
 
-// Checksum = i1 ^ i2 ^ ... ^ in;
+// Checksum = i1 ^ i2 ^ ... ^ in, sobre a struct inteira
 inline static uint8_t check_fun(const config_struct *cfg)
 {
-	int16_t res = 0;
+	uint8_t res = 0;
 	const uint8_t* values = (const uint8_t*)cfg;
-	for (uint8_t i = 0; i < sizeof(cfg); i++)
+	for (uint8_t i = 0; i < sizeof(*cfg); i++)
 		res ^= values[i];
 	return res;
 }
@@ -90,15 +60,16 @@ inline static uint8_t check_fun(const config_struct *cfg)
 void config_init()
 {
 	config_struct config_copy[3];
-	uint8_t check[3];
+	uint8_t check[3], version;
 
 	// Lê da EEPROM três vezes, para minimizar o risco de leitura errada
 	read_eeprom(config_copy, eeprom_configs, sizeof(eeprom_configs));
 	read_eeprom(check, eeprom_check, sizeof(eeprom_check));
+	read_eeprom(&version, &eeprom_version, sizeof(version));
 	
-	// Checksum simples, só para ver se a leitura completou
+	// Checksum simples, só para ver se a leitura completou, e a versão do formato
 	for (uint8_t j = 0; j < 3; j++)
-		if (check[j] != check_fun(&config_copy[j]))
+		if (version != CONFIG_VERSION || check[j] != check_fun(&config_copy[j]))
 		{
 			memcpy_P(&config_copy[j], &default_config, sizeof(config_struct));
 			check[j] = 0;
@@ -129,14 +100,58 @@ void config_init()
 	VOTE_PARAM(right_reverse);
 	VOTE_PARAM(esc_reverse);
 	VOTE_PARAM(esc_calibration_mode);
+	VOTE_PARAM(enc_quadrature);
+	VOTE_PARAM(enc_estimator);
+	VOTE_PARAM(recv_timeout);
+	VOTE_PARAM(recv_mode);
+	VOTE_PARAM(recv_filter);
+	VOTE_PARAM(control_period);
+	VOTE_PARAM(pid_mode);
+	VOTE_PARAM(pid_limit);
+	VOTE_PARAM(pid_kaw);
+	VOTE_PARAM(pid_d_shift);
+	VOTE_PARAM(feedforward);
 	
 #undef VOTE_PARAM
+
+	// Valores que travariam o robô (EEPROM corrompida ou gravada errado) voltam ao padrão
+#define RANGE_PARAM(par, min, max) do                                     \
+{                                                                         \
+	if (configs.par < (min) || configs.par > (max))                       \
+		memcpy_P(&configs.par, &default_config.par, sizeof(configs.par)); \
+} while (0)
+
+	// Abaixo de um frame do receptor o link nunca ficaria online
+	RANGE_PARAM(recv_timeout, RECV_TIMEOUT_MIN, 255);
+	// Um modo desconhecido contaria como FRAMED sem o rcbus_init()
+	RANGE_PARAM(recv_mode, RECV_MODE_PWM, RECV_MODE_PPM);
+	// Com limite 0 a tração não anda, e o shift do D segue a faixa do config-app.py
+	// (de 32 em diante ele nem é definido)
+	RANGE_PARAM(pid_mode, PID_MODE_INCREMENTAL, PID_MODE_BACK_CALC);
+	RANGE_PARAM(pid_limit, 1, MOTOR_MAX_POWER);
+	RANGE_PARAM(pid_d_shift, 0, 7);
+	// Tamanhos das janelas da arena: com 0 frames a média dos encoders divide por
+	// zero, e a mediana só aceita janelas ímpares
+	RANGE_PARAM(enc_frames, 1, ENC_MAX_FRAMES);
+	RANGE_PARAM(recv_samples, 1, MEDIAN_MAX_SAMPLES);
+	if (configs.recv_samples % 2 == 0)
+		memcpy_P(&configs.recv_samples, &default_config.recv_samples, sizeof(configs.recv_samples));
+	// O escalonador divide o período em passos do Timer2 (ver sched.c)
+	RANGE_PARAM(control_period, CONTROL_PERIOD_MIN, CONTROL_PERIOD_MAX);
+
+#undef RANGE_PARAM
+
+#ifdef SPECIALIZE
+	// Na build especializada esses valores são fixos, e a EEPROM é ignorada
+	configs.enc_frames = SPEC_ENC_FRAMES;
+	configs.recv_samples = SPEC_RECV_SAMPLES;
+#endif
 }
 
 inline static void config_save()
 {
 	// Checksum
-	int16_t check[3];
+	uint8_t check[3], version = CONFIG_VERSION;
 	check[0] = check[1] = check[2] = check_fun(&configs);
 	
 	// Escreve três vezes para haver baixo risco de corrupção de dados
@@ -144,9 +159,13 @@ inline static void config_save()
 	
 	for (uint8_t i = 0; i < 3; i++)
 		update_eeprom(&eeprom_configs[i], &configs, sizeof(config_struct));
+	
+	// A versão por último: uma gravação interrompida por cima de uma EEPROM de
+	// outra versão continua sendo ignorada
+	update_eeprom(&eeprom_version, &version, sizeof(version));
 		
 	// Aguarda o EEPROM terminar seu serviço
-	while (EECR & _BV(EEPE));
+	eeprom_wait();
 }
 
 // Tamanho de cada elemento na struct de configuração (bem que podia ser gerado automaticamente :/)
@@ -166,6 +185,17 @@ inline static uint8_t cfg_size(uint8_t id)
 		case 9: return sizeof(configs.right_reverse);
 		case 10: return sizeof(configs.esc_reverse);
 		case 11: return sizeof(configs.esc_calibration_mode);
+		case 12: return sizeof(configs.enc_quadrature);
+		case 13: return sizeof(configs.enc_estimator);
+		case 14: return sizeof(configs.recv_timeout);
+		case 15: return sizeof(configs.recv_mode);
+		case 16: return sizeof(configs.recv_filter);
+		case 17: return sizeof(configs.control_period);
+		case 18: return sizeof(configs.pid_mode);
+		case 19: return sizeof(configs.pid_limit);
+		case 20: return sizeof(configs.pid_kaw);
+		case 21: return sizeof(configs.pid_d_shift);
+		case 22: return sizeof(configs.feedforward);
 		default: return 0;
 	}
 }
@@ -187,6 +217,17 @@ inline static void* cfg_ptr(uint8_t id)
 		case 9: return &configs.right_reverse;
 		case 10: return &configs.esc_reverse;
 		case 11: return &configs.esc_calibration_mode;
+		case 12: return &configs.enc_quadrature;
+		case 13: return &configs.enc_estimator;
+		case 14: return &configs.recv_timeout;
+		case 15: return &configs.recv_mode;
+		case 16: return &configs.recv_filter;
+		case 17: return &configs.control_period;
+		case 18: return &configs.pid_mode;
+		case 19: return &configs.pid_limit;
+		case 20: return &configs.pid_kaw;
+		case 21: return &configs.pid_d_shift;
+		case 22: return &configs.feedforward;
 		default: return 0;
 	}
 }
@@ -229,9 +270,16 @@ void config_status()
 		if (!rx_data_blocking(buffer, size)) goto reinit;
 		
 		// Comando de leitura
-		if ((buffer[0] & 0xF0) == READ_CHUNK)
+		uint8_t cmd = buffer[0] & 0xF0;
+		uint8_t cfg = buffer[0] & 0x0F;
+		if (cmd == READ_CHUNK_HIGH || cmd == WRITE_CHUNK_HIGH)
+		{
+			cmd -= 0x10;
+			cfg += 16;
+		}
+		
+		if (cmd == READ_CHUNK)
 		{
-			uint8_t cfg = buffer[0] & 0x0F;
 			if (cfg >= num_cfgs)
 				TX_ERROR(ERROR_INVALID_VARIABLE);
 
@@ -240,10 +288,9 @@ void config_status()
 			tx_data(cfg_ptr(cfg), cfg_size(cfg));
 		}
 		// Comando de escrita
-		else if ((buffer[0] & 0xF0) == WRITE_CHUNK)
+		else if (cmd == WRITE_CHUNK)
 		{
-			uint8_t cfg = buffer[0] & 0x0F;
-		
+
 			if (cfg >= num_cfgs)
 				TX_ERROR(ERROR_INVALID_VARIABLE);
 			if (size < sizeof(uint8_t) + cfg_size(cfg))
@@ -270,8 +317,3 @@ void config_status()
 	// Loop infinito para forçar o processador a resetar (watchdog)
 	for (;;);
 }
-
-config_struct* get_config()
-{
-	return &configs;
-}
@@ -0,0 +1,381 @@
+//
+// control.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem o núcleo de controle do robô: as tarefas do
+// escalonador (ver sched.c), o PID dos motores, o controle do ESC e
+// o failsafe. Ele não mexe em nenhum registrador: tudo passa pelos
+// módulos de entrada e saída, então também compila no build do
+// computador (make host, ver hal.h)
+//
+// Aqui há um uso pesado de aritmética fixed-point. Por isso, há
+// anotações em inteiros que são interpretados dessa forma
+//
+
+#include "default.h"
+
+#define BLINK_FRAMES 8
+
+#define SGN(x,v) ((x)>0 ? (v) : (x)<0 ? -(v) : 0)
+
+#include <stdlib.h>
+
+// Variáveis para o PID: todas elas são fixed-point 16.16 (last_in e d_filt só
+// nos modos posicionais, e err_int é o termo I já multiplicado pelo ganho)
+int32_t cur_out_l = 0, err_int_l = 0, last_err_l = 0, target_l = 0, last_in_l = 0, d_filt_l = 0;
+int32_t cur_out_r = 0, err_int_r = 0, last_err_r = 0, target_r = 0, last_in_r = 0, d_filt_r = 0;
+
+// Feedforward de cada motor (0 sem ele), em 16.16
+int32_t ff_l = 0, ff_r = 0;
+
+// PWM em regime para as velocidades 0, 32, ..., 256 dos encoders, do motor
+// esquerdo e do direito, com o robô andando reto. Os valores são os do modelo
+// do simulador (host/sim -c), em malha aberta, que não foi comparado com o robô
+// de verdade (nem os ganhos da configuração padrão servem para ele, ver sim.c);
+// no robô, devem ser medidos da mesma forma: PWM fixo nos dois lados e a
+// velocidade em regime
+const uint8_t PROGMEM ff_table[2][FF_POINTS] =
+{
+	{ 0, 35, 67, 99, 131, 164, 196, 228, 250 },
+	{ 0, 35, 67, 99, 131, 164, 196, 228, 250 },
+};
+
+// Passo do controle em relação ao tick de 8192 us, em que os ganhos dos modos
+// posicionais são dados (como as velocidades dos encoders, ver input.c):
+// pid_dt = control_period / 8192 e pid_rate = 8192 / control_period, em 8.8
+int16_t pid_dt, pid_rate;
+
+// Começa em failsafe: os motores e a arma só são armados quando o receptor estiver online
+uint8_t failsafe_active = 1;
+
+//                    16.16           16.16         8.8         8.8         8.8             16.16             16.16              16.16
+void pid_control(int32_t in, int32_t target, int16_t kp, int16_t ki, int16_t kd, int32_t *cur_out, int32_t *err_int, int32_t *last_err);
+//                       16.16           16.16         8.8         8.8         8.8       16.16             16.16             16.16             16.16            16.16
+void pid_control_pos(int32_t in, int32_t target, int16_t kp, int16_t ki, int16_t kd, int32_t ff, int32_t *cur_out, int32_t *err_int, int32_t *last_in, int32_t *d_filt);
+//                             16.16
+int32_t ff_lookup(const uint8_t *table, int32_t target);
+void esc_control();
+void failsafe_control();
+void failsafe_rearm();
+
+// Chamada depois de config_init(), como o input_init()
+void control_init()
+{
+	uint16_t period = sched_control_period();
+	pid_dt = period / 32;
+	pid_rate = (8192UL << 8) / period;
+}
+
+// TAREFAS (ver sched.c), na ordem de prioridade
+
+// Controle: encoders, PID e motores, a cada control_period us
+void control_task()
+{
+	input_read_enc();
+
+	if (recv_online())
+	{
+		if (failsafe_active) failsafe_rearm();
+
+		int32_t enc_l = enc_speed_left();  // 16.16
+		int32_t enc_r = enc_speed_right(); // 16.16
+		
+		// Sem quadratura, o sentido é o mesmo da saída; com ela, a
+		// velocidade já vem com o sentido de rotação
+		if (!get_config()->enc_quadrature)
+		{
+			enc_l = SGN(cur_out_l, enc_l);
+			enc_r = SGN(cur_out_r, enc_r);
+		}
+
+		// regula o "peso" do PID: 0 a 512 é 0 a 1 em Q.9
+		int16_t knob_blend = recv_get_ch(3) + 256;
+		if (knob_blend < 0) knob_blend = 0;
+		if (knob_blend > 512) knob_blend = 512;
+
+		// Parado, o D acompanha a medida para não dar um tranco na partida
+		if (target_l == 0)
+		{
+			cur_out_l = err_int_l = last_err_l = d_filt_l = ff_l = 0;
+			last_in_l = enc_l;
+		}
+		else
+		{
+			// Com o feedforward, a referência do "peso" do PID é a tabela, e não o alvo
+			int32_t ref_l = target_l;
+			if (get_config()->feedforward)
+			{
+				ref_l = ff_lookup(ff_table[0], target_l);
+				// No modo incremental a saída acumula: ela só recebe a mudança da tabela
+				cur_out_l = q_add(cur_out_l, q_sub(ref_l, ff_l));
+				ff_l = ref_l;
+			}
+
+			// PID do motor esquerdo
+			if (get_config()->pid_mode == PID_MODE_INCREMENTAL)
+				pid_control(enc_l, target_l,
+						    get_config()->left_kp, get_config()->left_ki, get_config()->left_kd,
+						    &cur_out_l, &err_int_l, &last_err_l);
+			else
+				pid_control_pos(enc_l, target_l,
+						        get_config()->left_kp, get_config()->left_ki, get_config()->left_kd, ff_l,
+						        &cur_out_l, &err_int_l, &last_in_l, &d_filt_l);
+			cur_out_l = q_add(ref_l, q_scale(knob_blend, q_sub(cur_out_l, ref_l), 9));
+			CLAMP(cur_out_l, 1024L << 16);
+			
+		}
+		
+		if (target_r == 0)
+		{
+			cur_out_r = err_int_r = last_err_r = d_filt_r = ff_r = 0;
+			last_in_r = enc_r;
+		}
+		else
+		{
+			// Com o feedforward, a referência do "peso" do PID é a tabela, e não o alvo
+			int32_t ref_r = target_r;
+			if (get_config()->feedforward)
+			{
+				ref_r = ff_lookup(ff_table[1], target_r);
+				// No modo incremental a saída acumula: ela só recebe a mudança da tabela
+				cur_out_r = q_add(cur_out_r, q_sub(ref_r, ff_r));
+				ff_r = ref_r;
+			}
+
+			// PID do motor direito
+			if (get_config()->pid_mode == PID_MODE_INCREMENTAL)
+				pid_control(enc_r, target_r,
+						    get_config()->right_kp, get_config()->right_ki, get_config()->right_kd,
+						    &cur_out_r, &err_int_r, &last_err_r);
+			else
+				pid_control_pos(enc_r, target_r,
+						        get_config()->right_kp, get_config()->right_ki, get_config()->right_kd, ff_r,
+						        &cur_out_r, &err_int_r, &last_in_r, &d_filt_r);
+			cur_out_r = q_add(ref_r, q_scale(knob_blend, q_sub(cur_out_r, ref_r), 9));
+			CLAMP(cur_out_r, 1024L << 16);
+		}
+
+		// Finalmente
+		motor_set_power_left(cur_out_l >> 16);  // de volta para 16.0
+		motor_set_power_right(cur_out_r >> 16); // idem
+	}
+}
+
+// Frame de 8192 us: watchdog, LED, arma e failsafe
+void frame_task()
+{
+	// O watchdog é alimentado aqui, e não nos interrupts do receptor: se o loop
+	// principal travar, o uC reinicia; se o receptor cair, quem age é o failsafe
+	wdt_reset();
+
+	static uint8_t frame_counter = 0;
+	led_set(frame_counter < BLINK_FRAMES);
+	if (++frame_counter == 2*BLINK_FRAMES) frame_counter = 0;
+	
+	load_update();
+	stack_scan_step();
+	
+	// A arma só volta depois que o controle sair do failsafe
+	if (!recv_online()) failsafe_control();
+	else if (!failsafe_active) esc_control();
+}
+
+// Receptor: um pulso ou frame novo vira o alvo dos motores
+void recv_task()
+{
+	input_read_recv();
+	
+	int16_t ch0 = recv_get_ch(0);       // 16.0
+	int16_t ch1 = recv_get_ch(1);       // 16.0
+	if (recv_get_ch(2) > 0)
+	{
+		ch0 = -ch0;
+		ch1 = -ch1;
+	}
+	
+	target_l = (int32_t)(-ch0 + ch1) * 65536L;  // 16.16
+	if (get_config()->left_reverse) target_l = -target_l;
+	target_r = (int32_t)(-ch0 - ch1) * 65536L;  // 16.16
+	if (get_config()->right_reverse) target_r = -target_r;
+	
+	SETMIN(target_l, 22L << 16);
+	SETMIN(target_r, 22L << 16);
+	CLAMP(target_l, 250L << 16);
+	CLAMP(target_r, 250L << 16);
+}
+
+//                    16.16           16.16         8.8         8.8         8.8             16.16             16.16              16.16
+void pid_control(int32_t in, int32_t target, int16_t kp, int16_t ki, int16_t kd, int32_t *cur_out, int32_t *err_int, int32_t *last_err)
+{
+	// Tudo saturado (ver fixed.h): com um ganho de 1,0, (int32_t)kp * err dava a
+	// volta com erros acima de 128
+	int32_t err = q_sub(target, in);                         // 16.16
+	int32_t err_d = q_sub(err, *last_err);                   // 16.16
+	*err_int = q_add(*err_int, q_mul(ki, err));              // 16.16
+	*cur_out = q_add(*cur_out, q_div_pow2(*err_int, 7));     // err_int / 128
+	*cur_out = q_add(*cur_out, q_mul(kp, err));              // 16.16
+	*cur_out = q_add(*cur_out, q_mul(kd, err_d));            // 16.16
+	*last_err = err;                                         // 16.16
+}
+
+// PID posicional dos modos PID_MODE_CLAMP e PID_MODE_BACK_CALC, com os ganhos por
+// tick de 8192 us. A saída é limitada a pid_limit, a escala dos motores, e o
+// integrador não passa disso: no modo CLAMP ele não integra quando a saída está
+// saturada e o erro empurra para o mesmo lado; no BACK_CALC ele é puxado de volta
+// pela diferença entre a saída saturada e a calculada, com o ganho pid_kaw. O D
+// é sobre a medida (um degrau no alvo não dá tranco), passado por um filtro de
+// primeira ordem de pid_d_shift. O feedforward ff entra na saída antes da saturação
+void pid_control_pos(int32_t in, int32_t target, int16_t kp, int16_t ki, int16_t kd, int32_t ff, int32_t *cur_out, int32_t *err_int, int32_t *last_in, int32_t *d_filt)
+{
+	int32_t limit = (int32_t)get_config()->pid_limit << 16;    // 16.16
+	int32_t err = q_sub(target, in);                           // 16.16
+
+	// Derivada da medida por tick de 8192 us, filtrada
+	int32_t d = q_mul(pid_rate, q_sub(*last_in, in));          // 16.16
+	*d_filt = q_add(*d_filt, q_div_pow2(q_sub(d, *d_filt), get_config()->pid_d_shift));
+	*last_in = in;
+
+	int32_t p_d = q_add(q_add(q_mul(kp, err), q_mul(kd, *d_filt)), ff); // 16.16
+	int32_t i_step = q_mul(pid_dt, q_mul(ki, err));            // 16.16
+	int32_t out = q_add(p_d, *err_int);                        // 16.16
+	int32_t out_sat = out;
+	CLAMP(out_sat, limit);
+
+	if (get_config()->pid_mode == PID_MODE_BACK_CALC)
+		i_step = q_add(i_step, q_mul(pid_dt, q_mul(get_config()->pid_kaw, q_sub(out_sat, out))));
+	else if (out != out_sat && (err ^ out) >= 0) i_step = 0;
+
+	*err_int = q_add(*err_int, i_step);
+	CLAMP(*err_int, limit);
+	*cur_out = out_sat;
+}
+
+// Feedforward do alvo, interpolado na tabela (em PROGMEM) entre os dois pontos
+// vizinhos; acima do último ponto fica no último valor
+int32_t ff_lookup(const uint8_t *table, int32_t target)
+{
+	int32_t speed = target < 0 ? -target : target;                        // 16.16
+	uint8_t i = speed >> (16 + FF_STEP_SHIFT);
+	if (i >= FF_POINTS - 1) return SGN(target, (int32_t)pgm_read_byte(&table[FF_POINTS - 1]) * 65536L);
+
+	int16_t a = pgm_read_byte(&table[i]), b = pgm_read_byte(&table[i + 1]);
+	int32_t pos = speed - ((int32_t)i << (16 + FF_STEP_SHIFT));          // 16.16, 0 a 32
+	// (b - a) * pos / 32, com a diferença em 8.8 (pode ser negativa, então é multiplicada)
+	int32_t ff = q_add((int32_t)a * 65536L, q_mul((b - a) * (1 << (8 - FF_STEP_SHIFT)), pos));
+	return target < 0 ? -ff : ff;
+}
+
+// CONTROLE DO ESC
+#define ESC_DEADZONE 10
+#define ESC_DAMPING_TOTAL_TIME 36
+
+uint8_t esc_damping_frame = ESC_DAMPING_TOTAL_TIME, damping_available = 0;
+#define ESC_FIRST_DELAY 25
+uint8_t esc_first_delay = ESC_FIRST_DELAY;
+int16_t prev_esc = 0, filtered_esc = 0;
+
+int16_t esc_damping()
+{
+	if (esc_damping_frame < 12) return 8*esc_damping_frame;
+	else if (esc_damping_frame < 24) return 96 - 8*(esc_damping_frame - 12);
+	else return 0;
+}
+
+void esc_control()
+{
+	int16_t esc = recv_get_ch(4) + 12;
+	if (esc < -244) esc = -244;
+	if (esc >  244) esc =  244;
+	if (get_config()->esc_reverse) esc = -esc;
+
+	if (get_config()->esc_calibration_mode)
+	{
+		if (esc > 170) esc = 244;
+		else if (esc < -170) esc = -244;
+		else esc = 0;
+		
+		esc_set_power(esc);
+	}
+	else
+	{
+		if (esc_first_delay > 0)
+		{
+			esc_first_delay--;
+			return;
+		}
+	
+		if (esc_damping_frame < ESC_DAMPING_TOTAL_TIME)
+		{
+			esc = esc_damping();
+			esc_damping_frame++;
+		}
+		else
+		{
+			if (damping_available && prev_esc < ESC_DEADZONE && esc >= ESC_DEADZONE)
+			{
+				esc_damping_frame = 0;
+				damping_available = 0;
+			}
+			else if (!damping_available && prev_esc > -ESC_DEADZONE && esc <= -ESC_DEADZONE)
+				damping_available = 1;
+			else if (esc >= -ESC_DEADZONE && esc <= ESC_DEADZONE) esc = 0;
+		}
+
+		prev_esc = esc;
+	
+		filtered_esc += (esc - filtered_esc) * 7 / 16;
+		esc_set_power(filtered_esc);
+	}
+}
+
+// FAILSAFE
+// Se algum canal do receptor fica mais de recv_timeout ms sem pulso, os motores
+// e a arma vão a zero numa rampa linear de FAILSAFE_RAMP_FRAMES ticks de controle
+// (8,192 ms cada). O pior caso entre o último pulso e as saídas em zero é
+// recv_timeout + (FAILSAFE_RAMP_FRAMES+1) * 8,192 ms: 157 ms com o timeout padrão
+#define FAILSAFE_RAMP_FRAMES 6
+
+uint8_t failsafe_frame = 0;
+
+void failsafe_control()
+{
+	if (!failsafe_active)
+	{
+		failsafe_active = 1;
+		failsafe_frame = FAILSAFE_RAMP_FRAMES;
+		
+		// As medianas velhas não podem voltar a comandar o robô
+		recv_reset();
+		target_l = target_r = 0;
+		err_int_l = last_err_l = d_filt_l = ff_l = 0;
+		err_int_r = last_err_r = d_filt_r = ff_r = 0;
+	}
+	
+	if (failsafe_frame > 0)
+	{
+		// Em cada tick a saída perde 1/failsafe_frame do que resta
+		cur_out_l = cur_out_l / failsafe_frame * (failsafe_frame - 1);
+		cur_out_r = cur_out_r / failsafe_frame * (failsafe_frame - 1);
+		filtered_esc = filtered_esc / failsafe_frame * (failsafe_frame - 1);
+		failsafe_frame--;
+	}
+	
+	motor_set_power_left(cur_out_l >> 16);
+	motor_set_power_right(cur_out_r >> 16);
+	
+	// Se o ESC ainda não foi armado, continua sem receber pulsos
+	if (flags & ESC_AVAILABLE) esc_set_power(filtered_esc);
+}
+
+// O receptor voltou: o controle recomeça do zero e a arma espera o atraso inicial de novo
+void failsafe_rearm()
+{
+	failsafe_active = 0;
+	esc_first_delay = ESC_FIRST_DELAY;
+	esc_damping_frame = ESC_DAMPING_TOTAL_TIME;
+	damping_available = 0;
+	prev_esc = 0;
+}
@@ -0,0 +1,437 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+import subprocess
+import sys
+import re
+
+# Contagem estática de ciclos dos interrupts no out.elf (make bench-isr).
+# Para cada ISR é procurado, na desassemblagem, o caminho mais curto e o
+# mais longo da entrada até o reti, somando os ciclos de cada instrução
+# do ATMega328p (desvios tomados ou não, skips, chamadas com o custo da
+# função chamada). Os 7 ciclos da entrada (4 da resposta ao interrupt e
+# 3 do jmp no vetor) estão incluídos
+#
+# A média é uma estimativa: cada desvio condicional e cada skip é tomado
+# metade das vezes, e cada laço roda metade do seu limite
+#
+# Laços: o corpo de cada laço de uma função de LOOP_BOUNDS conta o limite
+# de voltas dela (o mesmo limite para todos os laços da função, então ele
+# tem que ser o do maior). Um laço fora da tabela é contado uma vez só e
+# marcado como "unbounded loop", e o máximo dele não é o pior caso; o
+# mesmo vale para as chamadas indiretas
+#
+# As tarefas do escalonador (sem os interrupts que as interrompem) também
+# são contadas, da entrada até o ret: o control_task é o custo de cada
+# tick do controle
+#
+# A janela com interrupts desligados é o maior entre o ISR mais longo e
+# o trecho mais longo do resto do programa entre um cli e o sei (ou a
+# volta do SREG) seguinte
+#
+# Os máximos são comparados com os de cycles.txt, e o script falha se
+# algum aumentou ou se o arquivo não existe; os que não estão no arquivo
+# são só mostrados. Com --update (make bench-isr UPDATE=1) os valores
+# medidos são gravados no arquivo, junto com os que já estavam lá
+#
+# O custo de um frame dos receptores seriais (FRAMES) é o de cada byte, no
+# USART_RX_vect e no rcbus_push(), vezes o tamanho do frame, mais o do
+# decodificador; só é mostrado, não entra no cycles.txt
+#
+# Os interrupts dos encoders também são conferidos contra as taxas de bordas
+# de EDGE_RATES: o pior caso de uma borda é a maior janela bloqueada por um
+# outro interrupt ou por um cli, mais uma passada de cada interrupt dos
+# encoders de prioridade maior, mais o próprio ISR, e isso tem que caber no
+# intervalo entre duas bordas do pino. Sem a desassemblagem, a janela é a
+# "blocked" de cycles.txt, ou ASSUMED_BLOCKED se ela não estiver lá
+#
+# Um arquivo de desassemblagem (o avrdisasm.txt do make dump) pode ser
+# passado no lugar do out.elf, e com --asm <arquivo.S> (make bench-asm)
+# os interrupts escritos à mão são contados direto do fonte, sem precisar
+# do avr-gcc
+
+F_CPU = 16000000
+ENTRY_CYCLES = 7
+TASKS = ("control_task", "frame_task", "recv_task", "telemetry_poll")
+BASELINE = "cycles.txt"
+
+# Limite de voltas dos laços de cada função
+LOOP_BOUNDS = {
+	# modo paralelo: 4 canais; PPM: a cópia de até RCBUS_MAX_CHANNELS canais
+	"__vector_4": 16,
+	# shift variável do bit de intervalo (_BV(head & 7))
+	"__vector_18": 8,
+	"rcbus_push": 8,
+	# 22 bytes de canais (e os shifts variáveis de até 10 bits dentro, contados
+	# também 22 vezes: o máximo fica bem acima do real)
+	"sbus_decode": 22,
+	# 30 bytes do checksum, 14 canais
+	"ibus_decode": 30,
+}
+
+# Frames dos receptores seriais: bytes por frame e o decodificador
+FRAMES = (("SBUS", 25, "sbus_decode"), ("iBUS", 32, "ibus_decode"))
+
+# Bordas por segundo no pino de cada interrupt dos encoders, em ordem de
+# prioridade (ver enc.S)
+EDGE_RATES = (("INT0_vect", 60000), ("INT1_vect", 48000), ("PCINT0_vect", 36000))
+# O TWI_vect (uns 150 ciclos) mais as seções com cli do loop (uns 30)
+ASSUMED_BLOCKED = 180
+
+VECTORS = {
+	1: "INT0_vect", 2: "INT1_vect", 3: "PCINT0_vect", 4: "PCINT1_vect",
+	5: "PCINT2_vect", 6: "WDT_vect", 7: "TIMER2_COMPA_vect", 8: "TIMER2_COMPB_vect",
+	9: "TIMER2_OVF_vect", 10: "TIMER1_CAPT_vect", 11: "TIMER1_COMPA_vect",
+	12: "TIMER1_COMPB_vect", 13: "TIMER1_OVF_vect", 14: "TIMER0_COMPA_vect",
+	15: "TIMER0_COMPB_vect", 16: "TIMER0_OVF_vect", 17: "SPI_STC_vect",
+	18: "USART_RX_vect", 19: "USART_UDRE_vect", 20: "USART_TX_vect",
+	21: "ADC_vect", 22: "EE_READY_vect", 23: "ANALOG_COMP_vect", 24: "TWI_vect",
+	25: "SPM_READY_vect",
+}
+VECTOR_NUMBERS = dict((name, "__vector_%d" % num) for num, name in VECTORS.items())
+
+# Ciclos das instruções que não levam 1 (AVR de 16 bits, sem RAMPZ)
+CYCLES = {
+	"adiw": 2, "sbiw": 2, "mul": 2, "muls": 2, "mulsu": 2, "fmul": 2, "fmuls": 2,
+	"fmulsu": 2, "ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2,
+	"push": 2, "pop": 2, "sbi": 2, "cbi": 2, "rjmp": 2, "ijmp": 2,
+	"lpm": 3, "elpm": 3, "rcall": 3, "icall": 3, "jmp": 3,
+	"call": 4, "ret": 4, "reti": 4,
+}
+SKIPS = ("cpse", "sbrc", "sbrs", "sbic", "sbis")
+# Instruções de duas palavras
+LONG_OPS = ("lds", "sts", "call", "jmp")
+
+line_re = re.compile(r'^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t(\S+)\s*([^;]*)')
+label_re = re.compile(r'^([0-9a-f]+) <([^>]+)>:')
+rel_re = re.compile(r'\.([+-]\d+)')
+
+# Nome de uma função no programa: o LTO pode pôr um sufixo nas static (.lto_priv.0)
+def find_func(name):
+	for f in funcs:
+		if f == name or f.startswith(name + "."): return f
+	return None
+
+class Instr:
+	def __init__(self, addr, size, op, args, func, tgt=None):
+		self.addr, self.size, self.op, self.args, self.func = addr, size, op, args.strip(), func
+		self.tgt = tgt
+
+	def target(self):
+		if self.tgt is not None: return self.tgt
+		m = rel_re.search(self.args)
+		if m: return self.addr + 2 + int(m.group(1))
+		try: return int(self.args.split(',')[-1].strip(), 0)
+		except ValueError: return None
+
+	def restores_sreg(self):
+		return self.op == "out" and (self.args.startswith("0x3f") or "SREG" in self.args)
+
+instrs = {}
+funcs = {}
+
+def parse_disasm(text):
+	func = None
+	for line in text.split('\n'):
+		m = label_re.match(line)
+		if m:
+			func = m.group(2)
+			funcs[func] = int(m.group(1), 16)
+			continue
+		m = line_re.match(line)
+		if m and func:
+			addr = int(m.group(1), 16)
+			instrs[addr] = Instr(addr, len(m.group(2).split()), m.group(3), m.group(4), func)
+
+# Fonte em assembly: as macros são expandidas, e os rótulos numéricos (1f, 2b)
+# resolvidos como no as. Os interrupts ganham o nome do vetor, como na
+# desassemblagem, para os valores de cycles.txt valerem nos dois modos
+def parse_asm(path):
+	macros = {}
+	lines = []
+
+	def expand(src, depth=0):
+		it = iter(src)
+		for line in it:
+			line = line.split(';')[0].strip()
+			if not line or line.startswith('#'): continue
+			words = line.split(None, 1)
+			if words[0] == ".macro":
+				parts = re.split(r'[\s,]+', words[1].strip())
+				body = []
+				for l in it:
+					if l.split(';')[0].strip() == ".endm": break
+					body.append(l)
+				macros[parts[0]] = (parts[1:], body)
+			elif words[0] in macros:
+				params, body = macros[words[0]]
+				args = [a.strip() for a in words[1].split(',')] if len(words) > 1 else []
+				sub = []
+				for l in body:
+					for p, a in sorted(zip(params, args), key=lambda pa: -len(pa[0])):
+						l = l.replace("\\" + p, a)
+					sub.append(l)
+				expand(sub, depth + 1)
+			else: lines.append(line)
+	expand(open(path).read().split('\n'))
+
+	# Primeira passada: endereços e rótulos
+	addr = 0
+	local = {}
+	placed = []
+	func = None
+	for line in lines:
+		m = re.match(r'^(\w+):\s*(.*)$', line)
+		if m:
+			name = m.group(1)
+			if name.isdigit(): local.setdefault(name, []).append(addr)
+			else:
+				func = VECTOR_NUMBERS.get(name, name)
+				funcs[func] = addr
+			line = m.group(2)
+			if not line: continue
+		if line.startswith('.'): continue
+		words = line.split(None, 1)
+		op = words[0].lower()
+		size = 4 if op in LONG_OPS else 2
+		placed.append((addr, size, op, words[1] if len(words) > 1 else "", func))
+		addr += size
+
+	# Segunda passada: alvos dos desvios
+	for addr, size, op, args, func in placed:
+		tgt = None
+		if op.startswith("br") or op in ("rjmp", "jmp", "rcall", "call"):
+			ref = args.split(',')[-1].strip()
+			m = re.match(r'^(\d+)([fb])$', ref)
+			if m:
+				defs = local.get(m.group(1), [])
+				if m.group(2) == 'f': cands = [a for a in defs if a > addr]
+				else: cands = [a for a in defs if a <= addr]
+				if cands: tgt = cands[0] if m.group(2) == 'f' else cands[-1]
+			else: tgt = funcs.get(VECTOR_NUMBERS.get(ref, ref))
+		instrs[addr] = Instr(addr, size, op, args, func, tgt if tgt is not None else -1)
+
+asm_mode = "--asm" in sys.argv
+if asm_mode:
+	parse_asm(sys.argv[sys.argv.index("--asm") + 1])
+elif len(sys.argv) > 1 and not sys.argv[-1].startswith("--"):
+	parse_disasm(open(sys.argv[-1]).read())
+else:
+	parse_disasm(subprocess.check_output(['avr-objdump', '-d', 'out.elf']))
+
+sys.setrecursionlimit(20000)
+
+# Soma n ciclos a um custo; None é um caminho que não volta ao cabeçalho do laço
+def plus(c, n):
+	return None if c is None else tuple(v + n for v in c)
+
+# Os dois lados de um desvio, com o custo de cada um já somado
+def either(a, b):
+	if a is None: return b
+	if b is None: return a
+	return (min(a[0], b[0]), (a[1] + b[1]) / 2.0, max(a[2], b[2]))
+
+class Path:
+	# stop: o cabeçalho do laço cuja volta está sendo contada; os caminhos que
+	# terminam sem voltar a ele não contam
+	def __init__(self, stop=None):
+		self.memo = {}
+		self.active = set()
+		self.notes = set()
+		self.headers = set()
+		self.stop = stop
+
+	# (mínimo, média, máximo) de ciclos de addr até o fim: o ret/reti, ou, no modo
+	# "cli", o sei ou a volta do SREG
+	def cost(self, addr, mode):
+		if addr == self.stop: return (0, 0, 0)
+		key = (addr, mode)
+		if key in self.memo: return self.memo[key]
+		if key in self.active:
+			self.headers.add(key)
+			# A volta de um laço com limite é somada no cabeçalho; sem limite, o
+			# corpo conta uma vez só
+			if LOOP_BOUNDS.get(instrs[addr].func.split(".")[0]) is not None: return None
+			return (0, 0, 0)
+		ins = instrs.get(addr)
+		if ins is None:
+			self.notes.add("unknown code")
+			return (0, 0, 0)
+
+		self.active.add(key)
+		result = self.step(ins, mode)
+		self.active.discard(key)
+
+		# Cabeçalho de um laço: soma as voltas, cada uma contada até voltar aqui
+		if key in self.headers and result is not None:
+			bound = LOOP_BOUNDS.get(ins.func.split(".")[0])
+			if bound is None: self.notes.add("unbounded loop")
+			else:
+				loop = Path(addr)
+				turn = loop.step(ins, mode) or (0, 0, 0)
+				self.notes |= loop.notes
+				result = (result[0], result[1] + turn[1] * bound / 2.0, result[2] + turn[2] * bound)
+		self.memo[key] = result
+		return result
+
+	# Custo de addr até o fim, para quem está fora do caminho
+	def total(self, addr, mode):
+		return self.cost(addr, mode) or (0, 0, 0)
+
+	# Custo de uma função chamada, sempre até o ret dela
+	def call(self, addr):
+		if self.stop is None: return self.total(addr, "isr")
+		path = Path()
+		c = path.total(addr, "isr")
+		self.notes |= path.notes
+		return c
+
+	def step(self, ins, mode):
+		addr, op = ins.addr, ins.op
+		end = (op in ("ret", "reti")) or (mode == "cli" and (op == "sei" or ins.restores_sreg()))
+		if end and self.stop is not None:
+			return None
+		if mode == "cli" and end:
+			return (1, 1, 1)
+		if op in ("ret", "reti"):
+			return (4, 4, 4)
+		if op in ("ijmp", "icall"):
+			self.notes.add("indirect call")
+			return None if self.stop is not None else (CYCLES[op],) * 3
+		if op in ("rjmp", "jmp"):
+			return plus(self.cost(ins.target(), mode), CYCLES[op])
+		if op in ("rcall", "call"):
+			callee = self.call(ins.target())
+			c = self.cost(addr + ins.size, mode)
+			return None if c is None else tuple(a + b + CYCLES[op] for a, b in zip(callee, c))
+		if op.startswith("br"):
+			a = self.cost(addr + ins.size, mode)
+			b = self.cost(ins.target(), mode)
+			return either(plus(a, 1), plus(b, 2))
+		if op in SKIPS:
+			a = self.cost(addr + ins.size, mode)
+			nxt = instrs.get(addr + ins.size)
+			skip = nxt.size // 2 if nxt else 1
+			b = self.cost(addr + ins.size + 2 * skip, mode)
+			return either(plus(a, 1), plus(b, 1 + skip))
+		return plus(self.cost(addr + ins.size, mode), CYCLES.get(op, 1))
+
+def entry_name(func):
+	m = re.match(r'__vector_(\d+)$', func)
+	return VECTORS.get(int(m.group(1)), func) if m else None
+
+results = []
+for func, addr in sorted(funcs.items(), key=lambda f: f[1]):
+	name = entry_name(func)
+	if not name or addr not in instrs: continue
+	path = Path()
+	lo, mean, hi = path.total(addr, "isr")
+	results.append((name, lo + ENTRY_CYCLES, mean + ENTRY_CYCLES, hi + ENTRY_CYCLES, ", ".join(sorted(path.notes))))
+
+tasks = []
+for func in TASKS:
+	if func not in funcs or funcs[func] not in instrs: continue
+	path = Path()
+	lo, mean, hi = path.total(funcs[func], "isr")
+	tasks.append((func, lo, mean, hi, ", ".join(sorted(path.notes))))
+
+cli_max = (0, None, "")
+for addr in sorted(instrs):
+	ins = instrs[addr]
+	if ins.op != "cli" or ins.func.startswith("__vector_"): continue
+	path = Path()
+	hi = path.total(addr + ins.size, "cli")[2] + 1
+	if hi > cli_max[0]: cli_max = (hi, "%s+0x%x" % (ins.func, addr - funcs[ins.func]), ", ".join(sorted(path.notes)))
+
+print "%-20s %6s %7s %6s %8s  %s" % ("ISR", "min", "mean", "max", "max us", "notes")
+for name, lo, mean, hi, notes in results:
+	print "%-20s %6d %7.1f %6d %8.2f  %s" % (name, lo, mean, hi, hi * 1e6 / F_CPU, notes)
+
+if tasks:
+	print
+	print "%-20s %6s %7s %6s %8s  %s" % ("Task", "min", "mean", "max", "max us", "notes")
+	for name, lo, mean, hi, notes in tasks:
+		print "%-20s %6d %7.1f %6d %8.2f  %s" % (name, lo, mean, hi, hi * 1e6 / F_CPU, notes)
+
+current = dict((r[0], r[3]) for r in results + tasks)
+
+# Ciclos por frame dos receptores seriais
+rx = [r for r in results if r[0] == "USART_RX_vect"]
+push = find_func("rcbus_push")
+if rx and push:
+	path = Path()
+	byte = path.total(funcs[push], "isr")
+	print
+	print "%-20s %6s %7s %6s %8s  %s" % ("Frame", "min", "mean", "max", "max us", "notes")
+	for name, size, decoder in FRAMES:
+		func = find_func(decoder)
+		if not func: continue
+		dec = path.total(funcs[func], "isr")
+		lo, mean, hi = [size * (r + b) + d for r, b, d in zip(rx[0][1:4], byte, dec)]
+		print "%-20s %6d %7.1f %6d %8.2f  %s" % (name + " frame", lo, mean, hi, hi * 1e6 / F_CPU, ", ".join(sorted(path.notes | set([rx[0][4]]) - set([""]))))
+
+# O fonte em assembly não tem o resto do programa: nem cli, nem os outros interrupts
+if not asm_mode:
+	isr_max = max(results, key=lambda r: r[3]) if results else ("-", 0, 0, 0, "")
+	print
+	print "Longest cli section: %d cycles at %s %s" % (cli_max[0], cli_max[1], cli_max[2])
+	blocked = max(isr_max[3], cli_max[0])
+	print "Worst interrupt-blocked window: %d cycles (%.2f us), %s" % (blocked, blocked * 1e6 / F_CPU,
+		isr_max[0] if isr_max[3] >= cli_max[0] else "cli section")
+	current["blocked"] = blocked
+
+# Comparação com a referência
+try:
+	baseline = dict((l.split()[0], int(l.split()[1])) for l in open(BASELINE) if l.strip())
+except IOError:
+	baseline = None
+
+# Taxa de bordas que os interrupts dos encoders aguentam
+over_budget = False
+enc_isrs = [name for name, rate in EDGE_RATES]
+if "blocked" in current:
+	others = [r[3] for r in results if r[0] not in enc_isrs]
+	blocking, source = max(others + [cli_max[0]]), "measured"
+elif baseline and "blocked" in baseline:
+	blocking, source = baseline["blocked"], "from " + BASELINE
+else:
+	blocking, source = ASSUMED_BLOCKED, "assumed"
+if any(name in current for name in enc_isrs):
+	print
+	print "Encoder edges, blocked by %d cycles (%s):" % (blocking, source)
+	print "%-20s %8s %9s %9s" % ("ISR", "worst", "max rate", "required")
+ahead = 0
+for name, rate in EDGE_RATES:
+	if name not in current: continue
+	worst = blocking + ahead + current[name]
+	ahead += current[name]
+	print "%-20s %8d %9d %9d%s" % (name, worst, F_CPU // worst, rate, "  OVER BUDGET" if F_CPU // worst < rate else "")
+	if F_CPU // worst < rate: over_budget = True
+
+if "--update" in sys.argv:
+	merged = dict(baseline or {})
+	merged.update(current)
+	with open(BASELINE, "w") as f:
+		for name in sorted(merged):
+			f.write("%s %d\n" % (name, merged[name]))
+	print "Baseline written to", BASELINE
+	sys.exit(0)
+
+if baseline is None:
+	print "No baseline (%s): run make bench-isr UPDATE=1 to create it" % BASELINE
+	sys.exit(1)
+
+regressed = False
+print
+for name in sorted(current):
+	if name not in baseline:
+		print "  %-20s %6s -> %6d (new, run with UPDATE=1 to track it)" % (name, "-", current[name])
+		continue
+	delta = current[name] - baseline[name]
+	if delta != 0: print "  %-20s %6d -> %6d (%+d)" % (name, baseline[name], current[name], delta)
+	if delta > 0: regressed = True
+if regressed:
+	print "Cycle count regression against", BASELINE
+if over_budget:
+	print "Encoder ISRs over the edge rate budget (EDGE_RATES)"
+if regressed or over_budget: sys.exit(1)
+print "No cycle count regression against", BASELINE
@@ -10,14 +10,12 @@
 // para o bom functionamento do programa
 //
 
-#include <avr/io.h>
-#include <avr/sleep.h>
-#include <avr/interrupt.h>
-#include <avr/wdt.h>
+#include "hal.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include "binaries.h"
+#include "fixed.h"
 
 #define SETMIN(p,m) do { if (p > -(m) && p < (m)) p = 0; } while (0)
 #define CLAMP(p,m) do { if (p > (m)) p = (m); else if (p < -(m)) p = -(m); } while (0)
@@ -36,29 +34,47 @@
 // A gente usa a funçaão wdt_off() porque a wdt_disable() possui erros
 void wdt_off();
 
+void clock_init();
+uint16_t clock_ticks();    // ticks de 0,5 us, só dentro de ISRs
+uint16_t clock_ticks_raw(uint16_t tcnt, uint8_t ovf, uint8_t tifr);
+uint32_t clock_now_us();
+
 void input_init();
 void input_read_enc();
 void input_read_recv();
 
 int16_t recv_get_ch(uint8_t ch);
 uint8_t recv_online();
-uint16_t enc_left();
-uint16_t enc_right();
+void recv_reset();
+int16_t enc_left();
+int16_t enc_right();
+int32_t enc_speed_left();
+int32_t enc_speed_right();
+
+// Máximo de frames na média dos encoders (enc_frames)
+#define ENC_MAX_FRAMES 32
+
+// Faixa dos motores: acima de MOTOR_MAX_POWER satura, e abaixo de MOTOR_MIN_POWER
+// o motor fica parado. A arma vai de -ESC_MAX_POWER a ESC_MAX_POWER
+#define MOTOR_MAX_POWER 250
+#define MOTOR_MIN_POWER 8
+#define ESC_MAX_POWER 244
 
-void motor_set_power_left(int16_t power);
-void motor_set_power_right(int16_t power);
-void led_set(uint8_t on);
-void esc_set_power(int16_t power);
+static inline int16_t motor_power(int16_t power)
+{
+	CLAMP(power, MOTOR_MAX_POWER);
+	if (power > -MOTOR_MIN_POWER && power < MOTOR_MIN_POWER) return 0;
+	return power;
+}
 
-void serial_init();
-void tx_data(const void* ptr, uint8_t sz);
 #define TX_VAR(v) tx_data(&v, sizeof(v))
-uint8_t rx_byte_available();
-uint8_t rx_data(void* ptr, uint8_t sz);
-uint8_t rx_data_blocking(void* ptr, uint8_t sz);
 #define RX_VAR(v) rx_data(&v, sizeof(v))
 #define RX_VAR_BLOCKING(v) rx_data_blocking(&v, sizeof(v))
-void rx_flush();
+
+// Carimbo de tempo bruto da última borda contada de cada encoder, escrito pelos
+// interrupts dos encoders (ver clock_ticks_raw() e input.c)
+typedef struct { uint16_t tcnt; uint8_t ovf, tifr; } enc_edge_raw;
+extern volatile enc_edge_raw enc_edge_l, enc_edge_r;
 
 void lcd_init();
 void lcd_clear();
@@ -66,10 +82,38 @@ void lcd_write_chars(uint8_t r, uint8_t c, const char *data, uint8_t size);
 #define LCD_WRITE_STR(r,c,str) lcd_write_chars((r),(c),(str),strlen(str))
 void lcd_write_int16(uint8_t r, uint8_t c, int16_t value);
 
-void twi_init();
-uint8_t twi_cmd_ready(uint8_t command);
-uint8_t twi_read(uint8_t address, volatile void* read_dest, uint8_t size);
-uint8_t twi_write(uint8_t address, const void* write_dest, uint8_t size);
+// Arena dos buffers dimensionados pela configuração e medição da pilha (ver arena.c)
+void* arena_alloc(uint16_t size);
+uint16_t arena_used();
+
+typedef struct
+{
+	uint16_t static_bytes; // .data e .bss
+	uint16_t arena_bytes;
+	uint16_t stack_max;    // maior profundidade da pilha já vista
+	uint16_t free_min;     // menor folga já vista entre a arena e a pilha
+} memory_stats_struct;
+
+void stack_paint();
+void stack_scan_step();
+const memory_stats_struct* memory_get_stats();
+
+// Mediana de janela deslizante (dois heaps com ponteiros de volta)
+#define MEDIAN_MAX_SAMPLES 31
+#define MEDIAN_BYTES(n) (4*(n)) // bytes da arena por janela de n amostras
+typedef struct
+{
+	uint16_t *data; // amostras, na ordem de chegada
+	int8_t *pos;    // posição de cada amostra no heap
+	uint8_t *heap;  // heap, apontando para o centro (a mediana)
+	uint8_t cur, samples;
+	int8_t half;
+} median_filter;
+
+uint8_t median_alloc(median_filter *m, uint8_t samples);
+void median_init(median_filter *m);
+void median_insert(median_filter *m, uint16_t value);
+uint16_t median_get(const median_filter *m);
 
 typedef struct
 {
@@ -78,12 +122,168 @@ typedef struct
 	uint8_t enc_frames, recv_samples;
 	uint8_t left_reverse, right_reverse, esc_reverse;
 	uint8_t esc_calibration_mode;
+	uint8_t enc_quadrature;
+	uint8_t enc_estimator;
+	uint8_t recv_timeout; // ms
+	uint8_t recv_mode;    // RECV_MODE_*
+	uint16_t recv_filter; // RECV_FILTER_* do canal i nos bits 2i e 2i+1
+	uint16_t control_period; // us
+	uint8_t pid_mode;     // PID_MODE_*
+	uint8_t pid_limit;    // saída máxima do PID, na escala dos motores (0 a 250)
+	uint16_t pid_kaw;     // 8.8, ganho do back-calculation
+	uint8_t pid_d_shift;  // filtro do D: a cada tick ele anda 1/2^n do caminho
+	uint8_t feedforward;  // 1 soma a tabela de feedforward à saída do PID
 } config_struct;
-#define num_cfgs 12
+#define num_cfgs 23
+
+// Leis de controle dos motores (ver control.c)
+#define PID_MODE_INCREMENTAL 0 // a lei original: a saída acumula o PID
+#define PID_MODE_CLAMP 1       // PID posicional, sem integrar quando satura
+#define PID_MODE_BACK_CALC 2   // PID posicional, com o integrador puxado de volta pela saturação
+
+// Tabela do feedforward: PWM em regime de cada motor para as velocidades
+// 0, 32, ..., 256 (ver ff_table em control.c)
+#define FF_STEP_SHIFT 5
+#define FF_POINTS 9
+
+// Filtros dos canais PWM do receptor (ver input.c)
+#define RECV_FILTER_MEDIAN 0
+#define RECV_FILTER_MEDIAN3_IIR 1
+#define RECV_FILTER_GATE_HOLD 2
+#define RECV_FILTER_ADAPTIVE 3
+
+// Modos de leitura do receptor
+#define RECV_MODE_PWM 0          // PWM, um canal depois do outro
+#define RECV_MODE_PWM_PARALLEL 1 // PWM, canais em qualquer ordem ou simultâneos
+#define RECV_MODE_SBUS 2         // SBUS na USART (com inversor externo)
+#define RECV_MODE_IBUS 3         // iBUS na USART
+#define RECV_MODE_PPM 4          // PPM (todos os canais num pino só, o PC0)
+
+// Modos que usam a USART
+#define RECV_MODE_SERIAL(m) ((m) == RECV_MODE_SBUS || (m) == RECV_MODE_IBUS)
+// Modos que dão o frame inteiro de uma vez, e por isso não passam pela mediana
+#define RECV_MODE_FRAMED(m) ((m) >= RECV_MODE_SBUS)
+
+// Larguras de pulso do receptor em ticks de 0,5 us (ver clock.c)
+#define RECV_MID 3080
+#define RECV_MIN 2328
+#define RECV_MAX 3832
+
+// Faixa de larguras plausíveis: o que estiver fora disso é descartado antes do filtro
+#define RECV_GATE_MIN (RECV_MIN - 400)
+#define RECV_GATE_MAX (RECV_MAX + 400)
+
+// Estatísticas de qualidade do link de cada canal PWM (ver input.c)
+typedef struct
+{
+	uint16_t accepted, rejected, missing; // pulsos
+	uint16_t jitter; // média de |largura - largura prevista|, em ticks de 0,5 us x16
+	uint16_t period; // período dos frames medido, em us
+} recv_stats_struct;
+const recv_stats_struct* recv_get_stats();
+
+// Receptor serial
+#define RCBUS_MAX_CHANNELS 16
+void rcbus_init(uint8_t recv_mode);
+uint8_t rcbus_read(uint16_t *channels);
 
 void config_init();
 void config_status();
-config_struct* get_config();
+
+// Inline para o endereço virar constante em todo módulo, sem chamada
+extern config_struct configs;
+static inline config_struct* get_config() { return &configs; }
+
+// Build especializada (make SPECIALIZE=1 ENC_FRAMES=8 RECV_SAMPLES=5): o número de
+// frames dos encoders e o de amostras da mediana viram constantes, e as divisões
+// por eles viram shifts ou multiplicações pelo recíproco
+#ifdef SPECIALIZE
+#if SPEC_ENC_FRAMES < 1 || SPEC_ENC_FRAMES > ENC_MAX_FRAMES
+#error "ENC_FRAMES deve estar entre 1 e 32"
+#endif
+#if SPEC_RECV_SAMPLES < 1 || SPEC_RECV_SAMPLES > MEDIAN_MAX_SAMPLES || SPEC_RECV_SAMPLES % 2 == 0
+#error "RECV_SAMPLES deve ser ímpar e estar entre 1 e 31"
+#endif
+#define CFG_ENC_FRAMES SPEC_ENC_FRAMES
+#define CFG_RECV_SAMPLES SPEC_RECV_SAMPLES
+#else
+#define CFG_ENC_FRAMES (get_config()->enc_frames)
+#define CFG_RECV_SAMPLES (get_config()->recv_samples)
+#endif
+
+void telemetry_init();
+uint8_t telemetry_ready();
+void telemetry_poll();
+
+// Tarefas do loop principal, na ordem de prioridade (ver sched.c)
+#define SCHED_CONTROL 0   // encoders, PID e motores, a cada control_period us
+#define SCHED_FRAME 1     // watchdog, LED, ESC e failsafe, a cada 8192 us
+#define SCHED_RECV 2      // receptor, quando chega pulso ou frame novo
+#define SCHED_TELEMETRY 3 // consultas pela serial
+#define SCHED_NUM_TASKS 4
+#define SCHED_PERIODIC(t) ((t) < SCHED_RECV)
+
+// Faixa de control_period, em us (ver sched.c)
+#define CONTROL_PERIOD_MIN 1000
+#define CONTROL_PERIOD_MAX 10000
+#define CONTROL_PERIOD_DEFAULT 8192
+
+typedef struct
+{
+	void (*run)();
+	uint16_t budget_us; // tempo de execução previsto
+} sched_task;
+
+typedef struct
+{
+	uint32_t releases;
+	uint32_t cpu_us;      // tempo total de execução
+	uint16_t skips;       // liberações perdidas (a anterior ainda não tinha começado)
+	uint16_t overruns;    // execuções que terminaram depois da próxima liberação
+	uint16_t over_budget; // execuções mais longas que budget_us
+	uint16_t deferrals;   // vezes que a tarefa esperou por não caber antes do controle
+	uint16_t latency_max; // us, da liberação ao começo
+	uint16_t latency_avg; // us x16
+	uint16_t exec_max;    // us
+} sched_stats_struct;
+
+extern volatile uint16_t sched_skips[SCHED_NUM_TASKS];
+void sched_init();
+uint8_t sched_released();
+uint16_t sched_control_period();
+uint8_t sched_run(const sched_task *tasks);
+void sched_get_stats(sched_stats_struct *dst);
+
+// Tarefas (ver control.c)
+void control_init();
+void control_task();
+void frame_task();
+void recv_task();
+
+// Carga da CPU, em milésimos de cada janela (ver load.c)
+typedef struct
+{
+	uint16_t idle_pm, isr_pm, task_pm;
+	uint16_t busy_max_pm; // maior ocupação já vista
+	uint16_t window_ms;
+} load_stats_struct;
+
+void load_init();
+void load_idle();
+void load_count_edges(uint16_t edges);
+void load_update();
+const load_stats_struct* load_get_stats();
+
+// Medição da duração de um ISR em C: deve ser a primeira linha do ISR, e a soma
+// é feita na saída, por qualquer return. O prólogo e o epílogo (uns 32 ciclos)
+// entram como estimativa
+extern volatile uint16_t load_isr_ticks;
+#define LOAD_ISR_OVERHEAD_TICKS 4
+static inline void load_isr_end(uint16_t *t0)
+{
+	load_isr_ticks += ((TCNT1 - *t0) & 2047) + LOAD_ISR_OVERHEAD_TICKS;
+}
+#define LOAD_ISR() uint16_t load_isr_t0 __attribute__((cleanup(load_isr_end))) = TCNT1
 
 
 
@@ -0,0 +1,57 @@
+//
+// eeprom.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem o acesso à EEPROM do ATMega328p, usado pela
+// configuração (ver config.c). No build do computador ele é
+// substituído pela EEPROM simulada de hal_host.c
+//
+
+#include "default.h"
+
+void read_eeprom(void* dst, const void* src, uint8_t sz)
+{
+	uint8_t* cdst = (uint8_t*)dst;
+	const uint8_t* csrc = (const uint8_t*)src;
+
+	for (uint8_t i = 0; i < sz; i++)
+	{
+		while (EECR & _BV(EEPE));   // Espera o bit EEPE ir a 0
+		EEAR = (uintptr_t)csrc+i;   // Define o endereço de leitura
+		EECR |= _BV(EERE);          // Comanda a leitura da EEPROM
+		cdst[i] = EEDR;             // Guarda o byte lido na SRAM
+	}
+}
+
+void update_eeprom(void* dst, const void* src, uint8_t sz)
+{
+	uint8_t* cdst = (uint8_t*)dst;
+	const uint8_t* csrc = (const uint8_t*)src;
+
+	for (uint8_t i = 0; i < sz; i++)
+	{
+		wdt_reset();
+		while (EECR & _BV(EEPE));   // Espera o bit EEPE ir a 0
+		EEAR = (uintptr_t)cdst+i;   // Endereço de escrita
+		
+		EECR |= _BV(EERE);          // Byte para comparação
+		uint8_t byte = EEDR;
+		
+		if (csrc[i] != byte)
+		{
+			EEAR = (uintptr_t)cdst+i;
+			EEDR = csrc[i];           // Byte a ser escrito
+			EECR |= _BV(EEMPE);       // "Desativa" a proteção da escrita
+			EECR |= _BV(EEPE);        // Comanda a escrita
+		}
+	}
+}
+
+// Espera a última escrita terminar
+void eeprom_wait()
+{
+	while (EECR & _BV(EEPE));
+}
@@ -0,0 +1,152 @@
+//
+// fixed.h
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem a aritmética fixed-point do controle. Os valores
+// são Q16.16 em int32_t (velocidades, alvos, saídas e erros do PID) e
+// os ganhos são Q8.8 em int16_t, como na configuração. Todas as
+// operações saturam nos limites do int32_t em vez de dar a volta
+//
+// O produto de um ganho por um valor tem 48 bits. No AVR ele é feito
+// com 8 MULs e duas correções de sinal (de 50 a 54 ciclos contados no
+// interpretador do test/fixed.c, sem chamada nem divisão); o avr-gcc
+// faria uma multiplicação de 64 bits, ou uma de 32 bits que transborda
+// com erros acima de 128 (0x0080_0000 vezes um ganho de 1,0). No build
+// do computador (HOST) é usado o int64_t
+//
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+#define Q_MAX INT32_MAX
+#define Q_MIN INT32_MIN
+
+// a + b, saturado
+static inline int32_t q_add(int32_t a, int32_t b)
+{
+	int32_t r = (int32_t)((uint32_t)a + (uint32_t)b);
+	// Só transborda se os dois têm o mesmo sinal e o resultado tem o outro
+	if (((a ^ r) & (b ^ r)) < 0) return a < 0 ? Q_MIN : Q_MAX;
+	return r;
+}
+
+// a - b, saturado
+static inline int32_t q_sub(int32_t a, int32_t b)
+{
+	int32_t r = (int32_t)((uint32_t)a - (uint32_t)b);
+	if (((a ^ b) & (a ^ r)) < 0) return a < 0 ? Q_MIN : Q_MAX;
+	return r;
+}
+
+// O produto de 48 bits no AVR: os bytes de k e de x multiplicados sem sinal e
+// somados na posição de cada par, e depois as correções de sinal: - x << 16 se
+// k < 0, e - k << 32 se x < 0. Fica fora do #ifdef para o test/fixed.c rodar
+// este mesmo texto num interpretador das instruções usadas e contar os ciclos
+#define Q_MUL48_ASM \
+	"clr %[z]"               "\n\t" \
+	"mul %A[k], %A[x]"       "\n\t" \
+	"mov %A[l], r0"          "\n\t" \
+	"mov %B[l], r1"          "\n\t" \
+	"mul %A[k], %C[x]"       "\n\t" \
+	"mov %C[l], r0"          "\n\t" \
+	"mov %D[l], r1"          "\n\t" \
+	"mul %B[k], %D[x]"       "\n\t" \
+	"mov %A[h], r0"          "\n\t" \
+	"mov %B[h], r1"          "\n\t" \
+	"mul %A[k], %B[x]"       "\n\t" \
+	"add %B[l], r0"          "\n\t" \
+	"adc %C[l], r1"          "\n\t" \
+	"adc %D[l], %[z]"        "\n\t" \
+	"adc %A[h], %[z]"        "\n\t" \
+	"adc %B[h], %[z]"        "\n\t" \
+	"mul %B[k], %A[x]"       "\n\t" \
+	"add %B[l], r0"          "\n\t" \
+	"adc %C[l], r1"          "\n\t" \
+	"adc %D[l], %[z]"        "\n\t" \
+	"adc %A[h], %[z]"        "\n\t" \
+	"adc %B[h], %[z]"        "\n\t" \
+	"mul %B[k], %B[x]"       "\n\t" \
+	"add %C[l], r0"          "\n\t" \
+	"adc %D[l], r1"          "\n\t" \
+	"adc %A[h], %[z]"        "\n\t" \
+	"adc %B[h], %[z]"        "\n\t" \
+	"mul %A[k], %D[x]"       "\n\t" \
+	"add %D[l], r0"          "\n\t" \
+	"adc %A[h], r1"          "\n\t" \
+	"adc %B[h], %[z]"        "\n\t" \
+	"mul %B[k], %C[x]"       "\n\t" \
+	"add %D[l], r0"          "\n\t" \
+	"adc %A[h], r1"          "\n\t" \
+	"adc %B[h], %[z]"        "\n\t" \
+	"sbrs %B[k], 7"          "\n\t" \
+	"rjmp 1f"                "\n\t" \
+	"sub %C[l], %A[x]"       "\n\t" \
+	"sbc %D[l], %B[x]"       "\n\t" \
+	"sbc %A[h], %C[x]"       "\n\t" \
+	"sbc %B[h], %D[x]"       "\n" \
+	"1:"                     "\n\t" \
+	"sbrs %D[x], 7"          "\n\t" \
+	"rjmp 2f"                "\n\t" \
+	"sub %A[h], %A[k]"       "\n\t" \
+	"sbc %B[h], %B[k]"       "\n" \
+	"2:"                     "\n\t" \
+	"clr __zero_reg__"
+
+// Produto de 48 bits: lo tem os bytes 0 a 3 e hi os bytes 4 e 5
+static inline void q_mul48(int16_t k, int32_t x, uint32_t *lo, int16_t *hi)
+{
+#ifdef HOST
+	int64_t p = (int64_t)k * x;
+	*lo = (uint32_t)p;
+	*hi = (int16_t)(p >> 32);
+#else
+	uint32_t l;
+	uint16_t h;
+	uint8_t zero;
+	asm (
+		Q_MUL48_ASM
+		: [l] "=&r" (l), [h] "=&r" (h), [z] "=&r" (zero)
+		: [k] "r" (k), [x] "r" (x)
+		: "r0"
+	);
+	*lo = l;
+	*hi = (int16_t)h;
+#endif
+}
+
+// (k * x) >> shift, saturado, para shift de 8 a 15 (o arredondamento é para baixo,
+// como no >> de um número negativo). Com shift constante, os shifts são só
+// movimentos de bytes
+static inline int32_t q_scale(int16_t k, int32_t x, uint8_t shift)
+{
+	uint32_t lo;
+	int16_t hi;
+	q_mul48(k, x, &lo, &hi);
+	// Cabe em 32 bits se os 33 - shift bits de cima do produto são todos iguais
+	int16_t top = hi >> (shift - 1);
+	if (top > 0) return Q_MAX;
+	if (top < -1) return Q_MIN;
+	return (int32_t)((lo >> shift) | ((uint32_t)hi << (32 - shift)));
+}
+
+// (k * x) >> 8, saturado: ganho Q8.8 vezes valor Q16.16 dá Q16.16
+static inline int32_t q_mul(int16_t k, int32_t x)
+{
+	return q_scale(k, x, 8);
+}
+
+// x / 2^n com o arredondamento da divisão do C (em direção ao zero), sem divisão.
+// Com n de 32 para cima o shift não é definido, e o quociente é sempre 0
+static inline int32_t q_div_pow2(int32_t x, uint8_t n)
+{
+	if (n > 31) return 0;
+	if (x < 0) x += (int32_t)(((uint32_t)1 << n) - 1);
+	return x >> n;
+}
+
+#endif
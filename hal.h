@@ -0,0 +1,85 @@
+//
+// hal.h
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo é a camada de abstração do hardware. Os módulos não
+// incluem os headers da avr-libc: incluem o default.h, que inclui
+// este arquivo. No build normal ele só traz os headers da avr-libc
+// e as macros dos registradores fixos, então o código gerado é o
+// mesmo de antes
+//
+// Com HOST definido (make host) os registradores de I/O viram
+// variáveis, os ISRs viram funções comuns e o sleep, o watchdog, a
+// PROGMEM e a EEPROM são simulados (ver hal_host.h). Os módulos de
+// hardware (serial.c, output.c, eeprom.c, arena.c, twi.c, lcd.c,
+// ina.c, telemetry.c, enc.S e o main.c) são trocados por hal_host.c,
+// e o núcleo de controle (entradas, relógio, escalonador,
+// configuração e control.c) compila com o gcc do computador
+//
+// A API da HAL, no fim do arquivo, é o que cada lado implementa:
+// saídas (PWM dos motores, ESC e LED), UART, EEPROM e TWI. No AVR
+// ela está em output.c, serial.c, eeprom.c e twi.c, e no
+// computador em hal_host.c. Os timers e os pinos de entrada não
+// passam por funções: o relógio (clock.c) e os interrupts leem os
+// registradores, que no computador são as variáveis do hal_host.h
+//
+
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef HOST
+
+#include "hal_host.h"
+
+#else
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+
+#define EEMEM __attribute__((section(".eeprom")))
+
+// Registradores reservados para os contadores dos encoders e do relógio
+// (--fixed-r3 ... --fixed-r7 no Makefile): o nome é o da variável em C e
+// reg é o registrador, em string ("r3")
+#define FIXED_REGISTER(name, reg) register unsigned char name asm(reg)
+#define CLEAR_FIXED_REGISTER(name, reg) asm("eor "reg", "reg"")
+
+#endif
+
+#include <stdint.h>
+
+// Saídas: potência dos motores de -MOTOR_MAX_POWER a MOTOR_MAX_POWER (ver
+// motor_power() em default.h) e da arma de -ESC_MAX_POWER a ESC_MAX_POWER
+void motor_set_power_left(int16_t power);
+void motor_set_power_right(int16_t power);
+void led_set(uint8_t on);
+void esc_set_power(int16_t power);
+
+// UART: a leitura só acontece se sz bytes já chegaram; a versão bloqueante
+// espera um pouco por eles
+void serial_init();
+void tx_data(const void* ptr, uint8_t sz);
+uint8_t rx_byte_available();
+uint8_t rx_data(void* ptr, uint8_t sz);
+uint8_t rx_data_blocking(void* ptr, uint8_t sz);
+void rx_flush();
+
+// EEPROM: dst e src são endereços de variáveis EEMEM
+void read_eeprom(void* dst, const void* src, uint8_t sz);
+void update_eeprom(void* dst, const void* src, uint8_t sz);
+void eeprom_wait();
+
+// TWI: as operações entram numa fila e retornam o número do comando (ou -1
+// se a fila estiver cheia), que twi_cmd_ready() diz se já terminou
+void twi_init();
+uint8_t twi_cmd_ready(uint8_t command);
+uint8_t twi_read(uint8_t address, volatile void* read_dest, uint8_t size);
+uint8_t twi_write(uint8_t address, const void* write_dest, uint8_t size);
+
+#endif
@@ -0,0 +1,413 @@
+//
+// hal_host.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo é o hardware simulado do build do computador (ver
+// hal.h e hal_host.h). Ele substitui os módulos que falam direto
+// com os periféricos:
+//   - serial.c: duas filas de bytes
+//   - output.c: as saídas ficam em hal_host_output
+//   - eeprom.c: as variáveis EEMEM ficam na RAM, e começam em 0xFF,
+//     como numa EEPROM apagada
+//   - arena.c: a arena é um vetor estático, e a pilha não é medida
+//   - telemetry.c: sem telemetria
+//   - twi.c: dispositivos com bancos de registradores na RAM
+//   - enc.S: os mesmos interrupts dos encoders, em C
+// Os timers só andam em hal_host_run(): o Timer1 conta de 0 a ICR1
+// em ticks de 0,5 us, e o Timer2 conta um tick a cada 8 do Timer1
+//
+
+#include "default.h"
+
+#define HOST_SERIAL_LENGTH 256
+#define HOST_ARENA_LENGTH 1024
+#define HOST_TWI_DEVICES 4
+#define HOST_TWI_COMMANDS 8
+
+volatile uint8_t SREG, GPIOR0;
+volatile uint8_t PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2, EICRA, EIMSK;
+volatile uint8_t TIFR1, TIMSK1, TIFR2, TIMSK2, TCNT2, OCR2A, OCR2B;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+volatile uint16_t TCNT1, ICR1, UBRR0;
+
+hal_host_output_struct hal_host_output;
+
+// Prescaler do Timer2 em relação ao Timer1
+static uint8_t timer2_prescaler = 0;
+
+void hal_host_reset()
+{
+	SREG = GPIOR0 = 0;
+	PINB = PINC = PIND = PORTB = PORTC = PORTD = DDRB = DDRC = DDRD = 0;
+	PCICR = PCMSK0 = PCMSK1 = PCMSK2 = EICRA = EIMSK = 0;
+	TIFR1 = TIFR2 = TIMSK2 = TCNT2 = OCR2A = OCR2B = 0;
+	UCSR0A = UCSR0B = UCSR0C = UDR0 = 0;
+	TCNT1 = UBRR0 = 0;
+	timer2_prescaler = 0;
+	memset(&hal_host_output, 0, sizeof(hal_host_output));
+	hal_host_arena_reset();
+
+	// Como no main(): TOP em 2047 e interrupt no overflow do Timer1, e overflow
+	// e comparação B no Timer2
+	ICR1 = 2047;
+	TIMSK1 = _BV(TOIE1);
+	TIMSK2 = _BV(TOIE2) | _BV(OCIE2B);
+}
+
+// Roda os interrupts dos timers pendentes, na ordem de prioridade do ATMega328p;
+// retorna quantos rodaram
+static uint8_t hal_host_dispatch()
+{
+	uint8_t count = 0;
+	while (SREG & _BV(SREG_I))
+	{
+		if ((TIFR2 & _BV(OCF2B)) && (TIMSK2 & _BV(OCIE2B)))
+		{
+			TIFR2 &= (uint8_t)~_BV(OCF2B);
+			cli();
+			TIMER2_COMPB_vect();
+			sei();
+		}
+		else if ((TIFR1 & _BV(TOV1)) && (TIMSK1 & _BV(TOIE1)))
+		{
+			TIFR1 &= (uint8_t)~_BV(TOV1);
+			cli();
+			TIMER1_OVF_vect();
+			sei();
+		}
+		else break;
+		count++;
+	}
+	return count;
+}
+
+static void hal_host_tick()
+{
+	if (TCNT1 >= ICR1)
+	{
+		TCNT1 = 0;
+		TIFR1 |= _BV(TOV1);
+	}
+	else TCNT1++;
+
+	if (++timer2_prescaler == 8)
+	{
+		timer2_prescaler = 0;
+		if (++TCNT2 == 0) TIFR2 |= _BV(TOV2);
+		if (TCNT2 == OCR2B) TIFR2 |= _BV(OCF2B);
+	}
+}
+
+void hal_host_run(uint32_t ticks)
+{
+	hal_host_dispatch();
+	while (ticks--)
+	{
+		hal_host_tick();
+		hal_host_dispatch();
+	}
+}
+
+// Com os interrupts desligados o sleep nunca acordaria; aqui ele volta na hora
+void hal_host_sleep()
+{
+	if (!(SREG & _BV(SREG_I))) return;
+	while (!hal_host_dispatch()) hal_host_tick();
+}
+
+// SERIAL
+
+static uint8_t rx_queue[HOST_SERIAL_LENGTH], tx_queue[HOST_SERIAL_LENGTH];
+static uint16_t rx_head = 0, rx_tail = 0, tx_head = 0, tx_tail = 0;
+
+static uint16_t queue_size(uint16_t head, uint16_t tail)
+{
+	return (uint16_t)(head - tail) % HOST_SERIAL_LENGTH;
+}
+
+void hal_host_rx_push(const void *ptr, uint16_t sz)
+{
+	const uint8_t *cptr = (const uint8_t*)ptr;
+	for (uint16_t i = 0; i < sz && queue_size(rx_head + 1, rx_tail) != 0; i++)
+	{
+		rx_queue[rx_head] = cptr[i];
+		rx_head = (rx_head + 1) % HOST_SERIAL_LENGTH;
+	}
+}
+
+uint16_t hal_host_tx_pop(void *ptr, uint16_t sz)
+{
+	uint8_t *cptr = (uint8_t*)ptr;
+	uint16_t i;
+	for (i = 0; i < sz && tx_tail != tx_head; i++)
+	{
+		cptr[i] = tx_queue[tx_tail];
+		tx_tail = (tx_tail + 1) % HOST_SERIAL_LENGTH;
+	}
+	return i;
+}
+
+void serial_init()
+{
+	rx_head = rx_tail = tx_head = tx_tail = 0;
+}
+
+// Se a fila encher, os bytes mais antigos se perdem
+void tx_data(const void* ptr, uint8_t sz)
+{
+	const uint8_t* cptr = (const uint8_t*)ptr;
+	for (uint8_t i = 0; i < sz; i++)
+	{
+		tx_queue[tx_head] = cptr[i];
+		tx_head = (tx_head + 1) % HOST_SERIAL_LENGTH;
+		if (tx_head == tx_tail) tx_tail = (tx_tail + 1) % HOST_SERIAL_LENGTH;
+	}
+}
+
+uint8_t rx_byte_available()
+{
+	return rx_head != rx_tail;
+}
+
+// Como na serial de verdade, só lê se todos os bytes já chegaram (não há
+// quem mande mais bytes enquanto espera)
+uint8_t rx_data(void* ptr, uint8_t sz)
+{
+	if (queue_size(rx_head, rx_tail) < sz || sz == 0) return 0;
+
+	uint8_t* cptr = (uint8_t*)ptr;
+	for (uint8_t i = 0; i < sz; i++)
+	{
+		cptr[i] = rx_queue[rx_tail];
+		rx_tail = (rx_tail + 1) % HOST_SERIAL_LENGTH;
+	}
+	return 1;
+}
+
+uint8_t rx_data_blocking(void* ptr, uint8_t sz)
+{
+	return rx_data(ptr, sz);
+}
+
+void rx_flush()
+{
+	rx_tail = rx_head;
+}
+
+// SAÍDAS
+
+void motor_set_power_left(int16_t power)
+{
+	hal_host_output.motor_left = motor_power(power);
+}
+
+void motor_set_power_right(int16_t power)
+{
+	hal_host_output.motor_right = motor_power(power);
+}
+
+void esc_set_power(int16_t power)
+{
+	CLAMP(power, ESC_MAX_POWER);
+	hal_host_output.esc = power;
+	flags |= ESC_AVAILABLE;
+}
+
+void led_set(uint8_t on)
+{
+	hal_host_output.led = on;
+}
+
+// EEPROM
+
+void read_eeprom(void* dst, const void* src, uint8_t sz)
+{
+	memcpy(dst, src, sz);
+}
+
+void update_eeprom(void* dst, const void* src, uint8_t sz)
+{
+	memcpy(dst, src, sz);
+}
+
+void eeprom_wait() {}
+
+// O ld define o começo e o fim da seção; os símbolos são fracos para o caso de
+// nenhuma variável EEMEM ter sido ligada
+extern uint8_t __start_host_eeprom[] __attribute__((weak));
+extern uint8_t __stop_host_eeprom[] __attribute__((weak));
+
+__attribute__((constructor)) static void host_eeprom_erase()
+{
+	if (__start_host_eeprom) memset(__start_host_eeprom, 0xFF, __stop_host_eeprom - __start_host_eeprom);
+}
+
+// ARENA
+
+static uint8_t arena[HOST_ARENA_LENGTH];
+static uint16_t arena_top = 0;
+static memory_stats_struct memory_stats = { 0, 0, 0, 0xFFFF };
+
+void* arena_alloc(uint16_t size)
+{
+	if (size > HOST_ARENA_LENGTH - arena_top) return 0;
+	void *ptr = arena + arena_top;
+	arena_top += size;
+	return ptr;
+}
+
+uint16_t arena_used()
+{
+	return arena_top;
+}
+
+void hal_host_arena_reset()
+{
+	memset(arena, 0, sizeof(arena));
+	arena_top = 0;
+	memory_stats.static_bytes = memory_stats.arena_bytes = memory_stats.stack_max = 0;
+	memory_stats.free_min = 0xFFFF;
+}
+
+void stack_paint() {}
+void stack_scan_step() {}
+
+const memory_stats_struct* memory_get_stats()
+{
+	memory_stats.arena_bytes = arena_top;
+	return &memory_stats;
+}
+
+// TWI
+// As operações terminam na hora: uma escrita para um endereço sem dispositivo
+// (o NACK do barramento real) não faz nada, e uma leitura não mexe no destino
+
+typedef struct { uint8_t address, *regs, ptr; } host_twi_device;
+static host_twi_device twi_devices[HOST_TWI_DEVICES];
+static uint8_t twi_command = 0;
+
+void hal_host_twi_attach(uint8_t address, uint8_t *regs)
+{
+	for (uint8_t i = 0; i < HOST_TWI_DEVICES; i++)
+		if (!twi_devices[i].regs || twi_devices[i].address == address)
+		{
+			twi_devices[i].address = address;
+			twi_devices[i].regs = regs;
+			twi_devices[i].ptr = 0;
+			return;
+		}
+}
+
+static host_twi_device *twi_find(uint8_t address)
+{
+	for (uint8_t i = 0; i < HOST_TWI_DEVICES; i++)
+		if (twi_devices[i].regs && twi_devices[i].address == address) return &twi_devices[i];
+	return 0;
+}
+
+void twi_init()
+{
+	memset(twi_devices, 0, sizeof(twi_devices));
+	twi_command = 0;
+}
+
+uint8_t twi_cmd_ready(uint8_t command)
+{
+	return command < HOST_TWI_COMMANDS;
+}
+
+static uint8_t twi_next_command()
+{
+	uint8_t command = twi_command;
+	twi_command = (twi_command + 1) % HOST_TWI_COMMANDS;
+	return command;
+}
+
+uint8_t twi_read(uint8_t address, volatile void* read_dest, uint8_t size)
+{
+	host_twi_device *dev = twi_find(address);
+	volatile uint8_t *cptr = (volatile uint8_t*)read_dest;
+	if (dev)
+		for (uint8_t i = 0; i < size; i++)
+			cptr[i] = dev->regs[dev->ptr++];
+	return twi_next_command();
+}
+
+uint8_t twi_write(uint8_t address, const void* write_dest, uint8_t size)
+{
+	host_twi_device *dev = twi_find(address);
+	const uint8_t *cptr = (const uint8_t*)write_dest;
+	if (dev && size > 0)
+	{
+		dev->ptr = cptr[0];
+		for (uint8_t i = 1; i < size; i++)
+			dev->regs[dev->ptr++] = cptr[i];
+		dev->ptr = cptr[0];
+	}
+	return twi_next_command();
+}
+
+// TELEMETRIA
+
+void telemetry_init() {}
+uint8_t telemetry_ready() { return 0; }
+void telemetry_poll() {}
+
+// ENCODERS (ver enc.S)
+
+extern uint8_t enc_quad, enc_state_l, enc_state_r;
+extern const int8_t quad_table[16];
+extern unsigned char curl0_v, curl1_v, curr0_v, curr1_v, overflow_count_v;
+
+static void enc_stamp(volatile enc_edge_raw *edge)
+{
+	edge->tcnt = TCNT1;
+	edge->ovf = overflow_count_v;
+	edge->tifr = TIFR1;
+}
+
+static void enc_add(unsigned char *c0, unsigned char *c1, int8_t step)
+{
+	uint16_t count = ((uint16_t)*c1 << 8 | *c0) + step;
+	*c0 = count;
+	*c1 = count >> 8;
+}
+
+static void enc_quad_step(uint8_t *state, uint8_t a, uint8_t b, unsigned char *c0, unsigned char *c1, volatile enc_edge_raw *edge)
+{
+	uint8_t index = ((*state << 2) | (a ? 2 : 0) | (b ? 1 : 0)) & 0x0F;
+	*state = index & 0x03;
+	if (quad_table[index] == 0) return;
+	enc_add(c0, c1, quad_table[index]);
+	enc_stamp(edge);
+}
+
+ISR (INT0_vect)
+{
+	if (!enc_quad)
+	{
+		enc_add(&curl0_v, &curl1_v, 1);
+		enc_stamp(&enc_edge_l);
+	}
+	else enc_quad_step(&enc_state_l, PIND & _BV(PD2), PINB & _BV(PB0), &curl0_v, &curl1_v, &enc_edge_l);
+}
+
+ISR (INT1_vect)
+{
+	if (!enc_quad)
+	{
+		enc_add(&curr0_v, &curr1_v, 1);
+		enc_stamp(&enc_edge_r);
+	}
+	else enc_quad_step(&enc_state_r, PIND & _BV(PD3), PINB & _BV(PB4), &curr0_v, &curr1_v, &enc_edge_r);
+}
+
+ISR (PCINT0_vect)
+{
+	enc_quad_step(&enc_state_l, PIND & _BV(PD2), PINB & _BV(PB0), &curl0_v, &curl1_v, &enc_edge_l);
+	enc_quad_step(&enc_state_r, PIND & _BV(PD3), PINB & _BV(PB4), &curr0_v, &curr1_v, &enc_edge_r);
+}
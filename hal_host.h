@@ -0,0 +1,130 @@
+//
+// hal_host.h
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo é o lado do computador da camada de abstração do
+// hardware (ver hal.h): os registradores usados pelo núcleo de
+// controle, como variáveis, e as funções que um programa de teste
+// ou simulação usa para mexer neles. O tempo só anda quando o
+// programa chama hal_host_run() (ou quando o loop dorme em
+// load_idle()), e os interrupts dos timers rodam nesses momentos;
+// os outros ISRs (encoders, receptor, USART) são chamados
+// diretamente, depois de ajustar os pinos ou o UDR0
+//
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define _BV(b) (1 << (b))
+
+// Registradores de 8 bits
+extern volatile uint8_t SREG, GPIOR0;
+extern volatile uint8_t PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+extern volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2, EICRA, EIMSK;
+extern volatile uint8_t TIFR1, TIMSK1, TIFR2, TIMSK2, TCNT2, OCR2A, OCR2B;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+
+// Registradores de 16 bits
+extern volatile uint16_t TCNT1, ICR1, UBRR0;
+
+// Bits usados pelos módulos (mesmos números do ATMega328p)
+#define SREG_I 7
+#define TOV1 0
+#define TOIE1 0
+#define TOV2 0
+#define TOIE2 0
+#define OCF2A 1
+#define OCF2B 2
+#define OCIE2A 1
+#define OCIE2B 2
+#define PB0 0
+#define PB4 4
+#define PC0 0
+#define PD2 2
+#define PD3 3
+#define RXC0 7
+#define UDRE0 5
+#define FE0 4
+#define UPE0 2
+#define U2X0 1
+#define RXCIE0 7
+#define RXEN0 4
+#define TXEN0 3
+#define UPM01 5
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+
+#define RAMSTART 0x100
+#define RAMEND 0x8FF
+
+#define cli() (SREG &= (uint8_t)~_BV(SREG_I))
+#define sei() (SREG |= _BV(SREG_I))
+
+// Os ISRs viram funções comuns, que o programa de teste pode chamar
+#define ISR(vector, ...) void vector(void)
+void INT0_vect(void);
+void INT1_vect(void);
+void PCINT0_vect(void);
+void PCINT1_vect(void);
+void PCINT2_vect(void);
+void TIMER2_COMPB_vect(void);
+void TIMER1_OVF_vect(void);
+void USART_RX_vect(void);
+
+#define wdt_reset() ((void)0)
+#define sleep_enable() ((void)0)
+#define sleep_disable() ((void)0)
+#define sleep_cpu() hal_host_sleep()
+
+#define PROGMEM
+// As variáveis EEMEM ficam juntas numa seção, que começa apagada (ver hal_host.c)
+#define EEMEM __attribute__((section("host_eeprom")))
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
+// Os registradores fixos viram variáveis globais, que os encoders
+// simulados de hal_host.c também enxergam
+#define FIXED_REGISTER(name, reg) unsigned char name
+#define CLEAR_FIXED_REGISTER(name, reg) ((name) = 0)
+
+// Zera os registradores e a simulação, e configura o Timer1 como o main()
+void hal_host_reset();
+// Avança o tempo em ticks de 0,5 us, rodando os interrupts dos timers
+void hal_host_run(uint32_t ticks);
+// Avança o tempo até o próximo interrupt (o sleep_cpu() do load_idle())
+void hal_host_sleep();
+
+// Serial: bytes que o robô vai receber, e os que ele mandou
+void hal_host_rx_push(const void *ptr, uint16_t sz);
+uint16_t hal_host_tx_pop(void *ptr, uint16_t sz);
+
+// Zera a arena (hal_host_reset() também zera), para os módulos alocarem de novo
+void hal_host_arena_reset();
+
+// TWI: liga ao barramento um dispositivo com um banco de 256 registradores de 8
+// bits, como o INA219: o primeiro byte de cada escrita é o ponteiro, os outros são
+// escritos a partir dele, e as leituras começam no ponteiro da última escrita
+void hal_host_twi_attach(uint8_t address, uint8_t *regs);
+
+// Última saída mandada para os motores, a arma e o LED
+typedef struct
+{
+	int16_t motor_left, motor_right; // -250 a 250, 0 na zona morta (ver motor_power())
+	int16_t esc;                     // -244 a 244
+	uint8_t led;
+} hal_host_output_struct;
+extern hal_host_output_struct hal_host_output;
+
+#endif
@@ -15,35 +15,30 @@
 #define curl1 "r4"
 #define curr0 "r5"
 #define curr1 "r6"
-#define overflow_count "r7"
 
-register unsigned char curl0_v asm(curl0);
-register unsigned char curl1_v asm(curl1);
-register unsigned char curr0_v asm(curr0);
-register unsigned char curr1_v asm(curr1);
-register unsigned char overflow_count_v asm(overflow_count);
+FIXED_REGISTER(curl0_v, curl0);
+FIXED_REGISTER(curl1_v, curl1);
+FIXED_REGISTER(curr0_v, curr0);
+FIXED_REGISTER(curr1_v, curr1);
 
-// interrupt externo para ler o encoder esquerdo
-ISR (INT0_vect)
-{
-	curl0_v++;
-	if (curl0_v == 0) curl1_v++;
-}
+// Os interrupts dos encoders estão em enc.S; os dados abaixo são usados por eles
 
-// interrupt externo para ler o encoder direito
-ISR (INT1_vect)
-{ 
-	curr0_v++;
-	if (curr0_v == 0) curr1_v++;
-}
+// Modo de leitura dos encoders (cópia de get_config()->enc_quadrature)
+uint8_t enc_quad __attribute__((used)) = 0;
 
-// overflow to timer0, apenas para contagem de tempo
-ISR (TIMER0_OVF_vect)
-{
-	overflow_count_v++;
-	if (overflow_count_v % 8 == 0)
-		flags |= EXECUTE_ENC;
-}
+// Na quadratura, a fase A de cada encoder fica no INT0/INT1 (PD2/PD3) e a fase B
+// no PCINT0 (PB0 para o esquerdo, PB4 para o direito). O estado guardado tem a
+// fase A no bit 1 e a fase B no bit 0
+uint8_t enc_state_l __attribute__((used)) = 0, enc_state_r __attribute__((used)) = 0;
+
+// Tabela de transição da quadratura, indexada por (estado anterior << 2) | estado atual.
+// A adiantada em relação a B conta +1; transições impossíveis (as duas fases mudando
+// juntas) contam 0. O alinhamento deixa o enc.S indexar sem carry
+const int8_t quad_table[16] __attribute__((used,aligned(16))) =
+	{ 0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0 };
+
+// Carimbos das bordas (ver enc_edge_raw em default.h)
+volatile enc_edge_raw enc_edge_l __attribute__((used)), enc_edge_r __attribute__((used));
 
 //volatile uint8_t overflow_count = 0;
 volatile uint8_t cur_recv_bit = 0, cur_flag = B1;
@@ -52,129 +47,485 @@ volatile uint16_t last_times[5][2];
 volatile uint8_t updates[5];
 static uint8_t last_read = 0, last_read_d = 0;
 
-#define RECV_MID 385
-#define RECV_MIN 291
-#define RECV_MAX 479
+// Modo de leitura do receptor (cópia de get_config()->recv_mode)
+static uint8_t recv_mode = RECV_MODE_PWM;
+// Última foto dos pinos do receptor no PORTC, usada no modo paralelo
+static uint8_t last_port = 0;
+
+// PPM: a largura de cada canal é o tempo entre duas subidas, e um intervalo
+// maior que PPM_SYNC marca o começo de um frame. Tudo em ticks de 0,5 us
+#define PPM_MIN 1400   // 700 us
+#define PPM_MAX 4400   // 2200 us
+#define PPM_SYNC 5400  // 2700 us
+#define PPM_CENTER 3000 // 1500 us, o centro do PPM, que vira RECV_MID
+#define PPM_MIN_CHANNELS 5
+
+// ppm_work é preenchido pelo interrupt durante o frame; no sync, se o frame foi
+// válido, ele é copiado para ppm_frame e o loop principal é avisado
+static uint16_t ppm_work[RCBUS_MAX_CHANNELS];
+static volatile uint16_t ppm_frame[RCBUS_MAX_CHANNELS];
+static volatile uint8_t ppm_count = 0;
+static uint16_t ppm_last = 0;
+static uint8_t ppm_ch = 0;
+
 #define RECV_MULT 11
-#define RECV_DENOM 4
+#define RECV_DENOM 32
 
 #define ENC_DIVIDER 2
 
-#define RECV_SAMPLES 31
-uint16_t recv_readings[5][RECV_SAMPLES];
-uint8_t cur_order[5][RECV_SAMPLES];
-uint8_t cur_reading[5];
+// As janelas das medianas ficam na arena, alocadas em input_init()
+median_filter recv_filters[5];
 
-#define ENC_FRAMES 32
-uint16_t enc_frames_l[ENC_FRAMES];
+// Filtros dos canais PWM, escolhidos por canal em recv_filter (2 bits por canal).
+// Atraso de grupo, em frames do receptor (~20 ms cada):
+//   RECV_FILTER_MEDIAN:      (recv_samples-1)/2 (2 com o padrão, 15 com 31 amostras)
+//   RECV_FILTER_MEDIAN3_IIR: mediana de 3 (1 frame) mais IIR de 1 polo com alfa 1/2
+//                            (1 frame), 2 no total; tira glitches isolados e jitter
+//   RECV_FILTER_GATE_HOLD:   0; segura a última amostra boa (as que estão fora de
+//                            RECV_GATE_MIN..RECV_GATE_MAX nem chegam aqui), e saltos
+//                            maiores que RECV_GATE_STEP esperam 1 frame de confirmação
+//   RECV_FILTER_ADAPTIVE:    mediana de 3 mais IIR com alfa 1/4: 1 frame em degraus
+//                            maiores que RECV_ADAPTIVE_STEP, que são seguidos na hora,
+//                            e 4 frames nos movimentos pequenos, que são suavizados
+#define RECV_GATE_STEP 400
+#define RECV_ADAPTIVE_STEP 200
+
+static uint8_t recv_filter_mode[5];
+// Saída de cada filtro, em ticks, e o estado interno (o IIR em ticks x4, ou a
+// amostra esperando confirmação no gate)
+static uint16_t recv_out[5], recv_state[5];
+
+// Canais lidos do receptor serial, na mesma escala dos pulsos
+static uint16_t recv_values[RCBUS_MAX_CHANNELS];
+
+// Instante da última amostra de cada canal, para detectar receptor fora do ar
+static uint32_t recv_last_us[5];
+static uint32_t recv_timeout_us;
+
+// Estatísticas do link, que só são zeradas no boot (o failsafe não mexe nelas), e
+// o estado usado para calculá-las: o instante do último pulso, aceito ou não, e um
+// filtro alfa-beta das larguras aceitas (nível e inclinação por frame, em ticks x8,
+// com alfa de 1/4 e beta de 1/16), que segue o stick andando em rampa sem atraso
+static recv_stats_struct recv_stats[5];
+static uint32_t recv_seen_us[5];
+static uint16_t recv_level[5];
+static int16_t recv_slope[5];
+#define RECV_LEVEL_SHIFT 3
+#define RECV_ALPHA_SHIFT 2
+#define RECV_BETA_SHIFT 4
+// O nível e a inclinação ficam na faixa do gate, para caberem em 16 bits
+#define RECV_LEVEL_MIN ((int32_t)RECV_GATE_MIN << RECV_LEVEL_SHIFT)
+#define RECV_LEVEL_MAX ((int32_t)RECV_GATE_MAX << RECV_LEVEL_SHIFT)
+// jitter guarda a média x16 em ticks do desvio em relação à previsão do filtro, com
+// alfa de 1/16; o desvio satura em RECV_JITTER_MAX ticks para caber em 16 bits
+#define RECV_JITTER_SHIFT 4
+#define RECV_JITTER_MAX 4095
+// Um intervalo maior que 1,5 período entre pulsos conta os frames que faltaram
+#define RECV_PERIOD_MAX_US 40000
+#define SAT_INC(v, n) do { (v) = (v) > 0xFFFF - (n) ? 0xFFFF : (v) + (n); } while (0)
+
+// Os frames dos encoders também ficam na arena, com enc_frames entradas cada. Se
+// não couberem, input_fault fica em 1: os encoders não são lidos e o receptor
+// nunca fica online, então o failsafe segura os motores e a arma em zero
+static uint8_t input_fault = 0;
+uint16_t *enc_frames_l;
 uint16_t avg_frames_l = 0;
-uint16_t enc_frames_r[ENC_FRAMES];
+uint16_t *enc_frames_r;
 uint16_t avg_frames_r = 0;
 
 uint8_t cur_frame = 0;
 
-#define CLEARR(r) asm("eor "r", "r"")
+// Última foto dos contadores, que nunca são zerados
+static uint16_t last_count_l = 0, last_count_r = 0;
+
+// Estimador M/T: a velocidade é o número de bordas do tick dividido pelo tempo
+// exato entre a última borda do tick anterior e a última borda deste. Em alta
+// rotação isso é a contagem de um tick só (sem o atraso da média de enc_frames
+// ticks); em baixa rotação é o período entre bordas, com resolução de 1 us.
+// Se não houver bordas num tick, a velocidade é limitada a uma borda no tempo
+// desde a última, e vai a zero depois de ENC_MT_TIMEOUT_US
+#define ENC_MT_TIMEOUT_US 100000L
+// Bordas/us para as unidades de enc_left(): 8192 us por tick vezes 11/8 (11/32 na quadratura)
+#define ENC_MT_SCALE 11264L
+#define ENC_MT_SCALE_QUAD 2816L
+
+typedef struct
+{
+	uint32_t edge_us; // instante da última borda
+	int32_t speed;    // 16.16
+} enc_mt_state;
+
+static uint8_t enc_mt = 0;
+
+// As contagens por tick de controle são convertidas para contagens por 8192 us (o
+// tick original), para as unidades não mudarem com control_period. 8.8
+static uint16_t enc_rate_scale = 256;
+static enc_mt_state mt_l, mt_r;
 
 void input_init()
 {
 	cur_flag = B1;
+	recv_mode = get_config()->recv_mode;
+	last_port = PINC & B1111;
+	
+	// O receptor serial não usa os pinos de PWM (a USART é ligada em rcbus_init()),
+	// e o PPM só usa o PC0
+	if (RECV_MODE_SERIAL(recv_mode))
+	{
+		PCMSK1 = 0;
+		PCMSK2 = 0;
+	}
+	else if (recv_mode == RECV_MODE_PPM)
+	{
+		PCMSK1 = B00000001;
+		PCMSK2 = 0;
+		ppm_ch = RCBUS_MAX_CHANNELS + 1; // espera o primeiro sync
+	}
+	recv_timeout_us = (uint32_t)get_config()->recv_timeout * 1000;
 	for (uint8_t i = 0; i < 5; i++)
 	{
 		last_times[i][0] = 0;
 		last_times[i][1] = 0;
 
-		cur_reading[i] = 0;
 		updates[i] = 0;
-		
-		for (uint8_t j = 0; j < get_config()->recv_samples; j++)
+		recv_last_us[i] = 0;
+		recv_seen_us[i] = 0;
+		recv_level[i] = 0;
+		recv_slope[i] = 0;
+		memset(&recv_stats[i], 0, sizeof(recv_stats_struct));
+	}
+	
+	// Os frames dos encoders vêm primeiro na arena, porque sem eles não há controle.
+	// Com os tamanhos validados em config_init(), o pior caso (2 x 32 frames mais
+	// 5 x 31 amostras, 748 bytes) deve caber, mas uma falha não pode virar escrita
+	// fora da arena
+	enc_frames_l = arena_alloc(CFG_ENC_FRAMES * sizeof(uint16_t));
+	enc_frames_r = arena_alloc(CFG_ENC_FRAMES * sizeof(uint16_t));
+	input_fault = !enc_frames_l || !enc_frames_r;
+	if (!input_fault)
+		for (uint8_t i = 0; i < CFG_ENC_FRAMES; i++)
 		{
-			recv_readings[i][j] = 0;
-			cur_order[i][j] = j;
+			enc_frames_l[i] = 0;
+			enc_frames_r[i] = 0;
 		}
-	}
 	
-	CLEARR(curl0);
-	CLEARR(curl1);
-	CLEARR(curr0);
-	CLEARR(curr1);
-	CLEARR(overflow_count);
+	// Janelas das medianas: recv_samples no filtro de mediana, 3 nos de mediana de 3,
+	// e nenhuma no gate e nos modos de frame. Um canal cuja janela não coube fica
+	// no gate
+	if (!RECV_MODE_FRAMED(recv_mode))
+		for (uint8_t i = 0; i < 5; i++)
+		{
+			recv_filter_mode[i] = (get_config()->recv_filter >> (2*i)) & B11;
+			if (recv_filter_mode[i] != RECV_FILTER_GATE_HOLD &&
+				!median_alloc(&recv_filters[i], recv_filter_mode[i] == RECV_FILTER_MEDIAN ? CFG_RECV_SAMPLES : 3))
+				recv_filter_mode[i] = RECV_FILTER_GATE_HOLD;
+			// Sem amostras, o median_init() do recv_reset() não faz nada
+			if (recv_filter_mode[i] == RECV_FILTER_GATE_HOLD) recv_filters[i].samples = 0;
+		}
+	recv_reset();
+	
+	CLEAR_FIXED_REGISTER(curl0_v, curl0);
+	CLEAR_FIXED_REGISTER(curl1_v, curl1);
+	CLEAR_FIXED_REGISTER(curr0_v, curr0);
+	CLEAR_FIXED_REGISTER(curr1_v, curr1);
+	last_count_l = last_count_r = 0;
 	
-	for (uint8_t i = 0; i < get_config()->enc_frames; i++)
+	enc_mt = get_config()->enc_estimator;
+	enc_rate_scale = (8192UL << 8) / sched_control_period();
+	mt_l.edge_us = mt_r.edge_us = 0;
+	mt_l.speed = mt_r.speed = 0;
+	
+	enc_quad = get_config()->enc_quadrature;
+	if (enc_quad)
 	{
-		enc_frames_l[i] = 0;
-		enc_frames_r[i] = 0;
+		enc_state_l = ((PIND & _BV(2)) ? B10 : 0) | ((PINB & _BV(0)) ? B01 : 0);
+		enc_state_r = ((PIND & _BV(3)) ? B10 : 0) | ((PINB & _BV(4)) ? B01 : 0);
+		
+		EICRA = B0101;              // interrupt em qualquer mudança das fases A
+		PCMSK0 = _BV(0) | _BV(4);   // grupo B: fases B dos encoders
+		PCICR |= B001;
+	}
+}
+
+//                                          16.16
+static int32_t enc_mt_speed(int16_t edges, uint32_t dt)
+{
+	int32_t scale = enc_quad ? ENC_MT_SCALE_QUAD : ENC_MT_SCALE;
+	// 7 bits de fração na divisão para não estourar os 32 bits (multiplicações, e
+	// não shifts, porque edges pode ser negativo)
+	return (int32_t)edges * scale * 128 / (int32_t)dt * 512;
+}
+
+static void enc_mt_update(enc_mt_state *st, int16_t edges, uint16_t edge, uint32_t now)
+{
+	if (edges != 0)
+	{
+		// O carimbo da borda tem 16 bits em ticks de 0,5 us, mas a borda é deste tick
+		uint32_t edge_us = now - ((uint16_t)((uint16_t)(now << 1) - edge) >> 1);
+		uint32_t dt = edge_us - st->edge_us;
+		st->edge_us = edge_us;
+		if (dt != 0) st->speed = enc_mt_speed(edges, dt);
+	}
+	else
+	{
+		uint32_t dt = now - st->edge_us;
+		if (dt > ENC_MT_TIMEOUT_US) st->speed = 0;
+		else
+		{
+			int32_t bound = enc_mt_speed(1, dt);
+			if (st->speed > bound) st->speed = bound;
+			else if (st->speed < -bound) st->speed = -bound;
+		}
 	}
 }
 
 void input_read_enc()
 {
-	// Dá pra se virar com o interrupt ligado aqui, porque é ULTRA IMPORTANTE pegar todos
-	// os interrupts do encoder
+	uint16_t count_l, count_r;
+	enc_edge_raw edge_l, edge_r;
+	
+	if (input_fault) return;
+	
+	// Foto dos contadores e dos carimbos, com os interrupts desligados só durante
+	// as cópias (uns 30 ciclos). Os contadores nunca são zerados, então uma borda
+	// que chega agora só entra na próxima diferença, e nunca se perde
+	uint8_t sreg = SREG;
+	cli();
+	((uint8_t*)&count_l)[0] = curl0_v;
+	((uint8_t*)&count_l)[1] = curl1_v;
+	((uint8_t*)&count_r)[0] = curr0_v;
+	((uint8_t*)&count_r)[1] = curr1_v;
+	edge_l = enc_edge_l;
+	edge_r = enc_edge_r;
+	SREG = sreg;
+	
+	uint16_t delta_l = count_l - last_count_l;
+	uint16_t delta_r = count_r - last_count_r;
+	last_count_l = count_l;
+	last_count_r = count_r;
+	
+	// Na quadratura as diferenças têm sinal
+	load_count_edges((enc_quad && (int16_t)delta_l < 0 ? -delta_l : delta_l) +
+		(enc_quad && (int16_t)delta_r < 0 ? -delta_r : delta_r));
+	
 	avg_frames_l -= enc_frames_l[cur_frame];
-	((uint8_t*)&enc_frames_l[cur_frame])[0] = curl0_v;
-	((uint8_t*)&enc_frames_l[cur_frame])[1] = curl1_v;
-	avg_frames_l += enc_frames_l[cur_frame];
+	enc_frames_l[cur_frame] = delta_l;
+	avg_frames_l += delta_l;
 	
 	avg_frames_r -= enc_frames_r[cur_frame];
-	((uint8_t*)&enc_frames_r[cur_frame])[0] = curr0_v;
-	((uint8_t*)&enc_frames_r[cur_frame])[1] = curr1_v;
-	avg_frames_r += enc_frames_r[cur_frame];
+	enc_frames_r[cur_frame] = delta_r;
+	avg_frames_r += delta_r;
 	
-	CLEARR(curl0);
-	CLEARR(curr0);
-	CLEARR(curl1);
-	CLEARR(curr1);
+	if (enc_mt)
+	{
+		uint32_t now = clock_now_us();
+		enc_mt_update(&mt_l, delta_l, clock_ticks_raw(edge_l.tcnt, edge_l.ovf, edge_l.tifr), now);
+		enc_mt_update(&mt_r, delta_r, clock_ticks_raw(edge_r.tcnt, edge_r.ovf, edge_r.tifr), now);
+	}
 	
-	if (++cur_frame == get_config()->enc_frames) cur_frame = 0;
+	if (++cur_frame == CFG_ENC_FRAMES) cur_frame = 0;
 }
 
-void input_read_recv()
+#define DIFF(a,b) ((a) > (b) ? (a) - (b) : (b) - (a))
+
+// IIR de 1 polo em ticks x4, com alfa = 1/2^shift. Começa na primeira amostra, e
+// não no zero, para não passar pelo comando máximo ao contrário
+static uint16_t recv_iir(uint8_t i, uint16_t x, uint8_t shift)
 {
-	// Aqui não dá pra deixar o interrupt ligado, mas a gente só desliga o do grupo C
-	PCICR = 0;
-	for (uint8_t i = 0; i < 5; i++)
-		if (flags & (RECV_AVAL0 << i))
+	if (x > RECV_GATE_MAX) x = RECV_GATE_MAX; // não estoura em x4
+	uint16_t x4 = x << 2;
+	if (recv_state[i] == 0) recv_state[i] = x4;
+	else recv_state[i] += ((int16_t)(x4 - recv_state[i])) >> shift;
+	return recv_state[i] >> 2;
+}
+
+static uint16_t recv_filter(uint8_t i, uint16_t x)
+{
+	switch (recv_filter_mode[i])
+	{
+		case RECV_FILTER_MEDIAN3_IIR:
 		{
-			recv_readings[i][cur_reading[i]] = last_times[i][1] - last_times[i][0];
-			last_times[i][0] = 0;
-			last_times[i][1] = 0;
+			median_insert(&recv_filters[i], x);
+			return recv_iir(i, median_get(&recv_filters[i]), 1);
+		}
+		case RECV_FILTER_GATE_HOLD:
+		{
+			uint16_t pending = recv_state[i];
+			recv_state[i] = x;
+			if (recv_out[i] != 0 && DIFF(x, recv_out[i]) > RECV_GATE_STEP &&
+				DIFF(x, pending) > RECV_GATE_STEP) return recv_out[i];
+			return x;
+		}
+		case RECV_FILTER_ADAPTIVE:
+		{
+			median_insert(&recv_filters[i], x);
+			uint16_t m = median_get(&recv_filters[i]);
+			if (m > RECV_GATE_MAX) m = RECV_GATE_MAX;
+			if (DIFF(m, recv_state[i] >> 2) > RECV_ADAPTIVE_STEP) recv_state[i] = 0;
+			return recv_iir(i, m, 2);
 		}
-	PCICR = B110;
+		default:
+			median_insert(&recv_filters[i], x);
+			return median_get(&recv_filters[i]);
+	}
+}
+
+// Conta os frames perdidos pelo intervalo desde o pulso anterior, comparado com o
+// período aprendido (que segue os intervalos normais com alfa de 1/8)
+static void recv_count_frames(uint8_t i, uint32_t now)
+{
+	recv_stats_struct *st = &recv_stats[i];
+	uint32_t gap = now - recv_seen_us[i];
+	uint8_t first = recv_seen_us[i] == 0;
+	recv_seen_us[i] = now;
+	if (first) return;
 	
-	// Li o que eu precisava, posso reabilitar os interrupts
-	// Bubblesort nas amostras
-	for (uint8_t i = 0; i < 5; i++)
+	if (st->period == 0)
+	{
+		if (gap < RECV_PERIOD_MAX_US) st->period = gap;
+	}
+	else if (gap < st->period + st->period/2)
+		st->period += ((int16_t)((uint16_t)gap - st->period)) / 8;
+	else
 	{
-		if (!(flags & (RECV_AVAL0 << i))) continue;
+		uint32_t lost = (gap + st->period/2) / st->period - 1;
+		SAT_INC(st->missing, lost > 0xFFFF ? 0xFFFF : (uint16_t)lost);
+	}
+}
+
+// Filtro de plausibilidade: larguras fora de RECV_GATE_MIN..RECV_GATE_MAX (espículas,
+// bordas perdidas, intervalos entre frames) são contadas e descartadas antes de
+// entrar na janela do filtro. Retorna 1 se a amostra foi aceita
+static uint8_t recv_accept(uint8_t i, uint16_t width, uint32_t now)
+{
+	recv_stats_struct *st = &recv_stats[i];
+	recv_count_frames(i, now);
+	
+	if (width < RECV_GATE_MIN || width > RECV_GATE_MAX)
+	{
+		SAT_INC(st->rejected, 1);
+		return 0;
+	}
+	
+	SAT_INC(st->accepted, 1);
+	
+	// Jitter: desvio da largura em relação à previsão do filtro alfa-beta, e não à
+	// largura anterior, para que o movimento do stick não conte como jitter (só um
+	// degrau conta, nos poucos frames que o filtro leva para alcançá-lo)
+	int32_t scaled = (int32_t)width << RECV_LEVEL_SHIFT;
+	if (recv_level[i] == 0) recv_level[i] = scaled;
+	else
+	{
+		int32_t predicted = (int32_t)recv_level[i] + recv_slope[i];
+		int32_t error = scaled - predicted;
+		uint16_t dev = (error < 0 ? -error : error) >> RECV_LEVEL_SHIFT;
+		if (dev > RECV_JITTER_MAX) dev = RECV_JITTER_MAX;
+		st->jitter += ((int32_t)dev * (1 << RECV_JITTER_SHIFT) - st->jitter) / (1 << RECV_JITTER_SHIFT);
+		
+		predicted += error / (1 << RECV_ALPHA_SHIFT);
+		int32_t slope = recv_slope[i] + error / (1 << RECV_BETA_SHIFT);
+		if (predicted < RECV_LEVEL_MIN) predicted = RECV_LEVEL_MIN;
+		if (predicted > RECV_LEVEL_MAX) predicted = RECV_LEVEL_MAX;
+		CLAMP(slope, RECV_LEVEL_MAX - RECV_LEVEL_MIN);
+		recv_level[i] = predicted;
+		recv_slope[i] = slope;
+	}
+	return 1;
+}
+
+// Estatísticas dos 5 canais, para a telemetria. Só fazem sentido nos modos PWM:
+// o PPM já descarta os frames ruins no interrupt, e o receptor serial tem CRC
+const recv_stats_struct* recv_get_stats()
+{
+	return recv_stats;
+}
+
+void input_read_recv()
+{
+	uint16_t readings[5];
+	uint8_t aval, sreg;
+	uint32_t now;
 	
-		uint8_t k = 0;
-		for (; k < get_config()->recv_samples; k++)
-			if (cur_order[i][k] == cur_reading[i]) break;
+	// Receptor serial ou PPM: os canais saem direto do frame, sem mediana
+	if (RECV_MODE_FRAMED(recv_mode))
+	{
+		uint8_t n;
 		
-		while (k > 0 && recv_readings[i][cur_order[i][k]] <= recv_readings[i][cur_order[i][k-1]])
+		if (recv_mode == RECV_MODE_PPM)
+		{
+			PCICR &= ~B110;
+			n = ppm_count;
+			for (uint8_t i = 0; i < n; i++)
+				recv_values[i] = ppm_frame[i] + (RECV_MID - PPM_CENTER);
+			flags &= ~RECV_AVAL0;
+			PCICR |= B110;
+		}
+		else
 		{
-			cur_order[i][k] ^= cur_order[i][k-1];
-			cur_order[i][k-1] ^= cur_order[i][k];
-			cur_order[i][k] ^= cur_order[i][k-1];
-			k--;
+			flags &= ~RECV_AVAL0;
+			n = rcbus_read(recv_values);
 		}
 		
-		while (k < get_config()->recv_samples-1 && recv_readings[i][cur_order[i][k]] >= recv_readings[i][cur_order[i][k+1]])
+		if (n)
 		{
-			cur_order[i][k] ^= cur_order[i][k+1];
-			cur_order[i][k+1] ^= cur_order[i][k];
-			cur_order[i][k] ^= cur_order[i][k+1];
-			k++;
+			now = clock_now_us();
+			for (uint8_t i = 0; i < 5 && i < n; i++)
+				recv_last_us[i] = now;
 		}
+		return;
+	}
 
-		if (++cur_reading[i] == get_config()->recv_samples) cur_reading[i] = 0;
-		flags &= ~(RECV_AVAL0 << i);
+	// Aqui não dá pra deixar o interrupt ligado, mas a gente só desliga os do receptor
+	PCICR &= ~B110;
+	aval = flags;
+	for (uint8_t i = 0; i < 5; i++)
+		if (aval & (RECV_AVAL0 << i))
+		{
+			readings[i] = last_times[i][1] - last_times[i][0];
+			last_times[i][0] = 0;
+			last_times[i][1] = 0;
+		}
+	// O TIMER1_OVF_vect mexe nas flags, então a limpeza de vários bits tem que ser atômica
+	sreg = SREG;
+	cli();
+	flags &= ~EXECUTE_RECV;
+	SREG = sreg;
+	PCICR |= B110;
+	
+	// Li o que eu precisava, posso reabilitar os interrupts
+	// Atualiza o filtro de cada canal que recebeu amostra nova e plausível
+	now = clock_now_us();
+	for (uint8_t i = 0; i < 5; i++)
+		if ((aval & (RECV_AVAL0 << i)) && recv_accept(i, readings[i], now))
+		{
+			recv_out[i] = recv_filter(i, readings[i]);
+			recv_last_us[i] = now;
+		}
+}
+
+// Zera os filtros e os canais do receptor serial (usado no failsafe)
+void recv_reset()
+{
+	for (uint8_t i = 0; i < 5; i++)
+	{
+		if (!RECV_MODE_FRAMED(recv_mode)) median_init(&recv_filters[i]);
+		recv_out[i] = 0;
+		recv_state[i] = 0;
 	}
+	for (uint8_t i = 0; i < RCBUS_MAX_CHANNELS; i++)
+		recv_values[i] = 0;
+}
+
+// Valor do canal antes da escala: mediana dos pulsos ou o valor do receptor serial
+static uint16_t recv_raw(uint8_t ch)
+{
+	if (RECV_MODE_FRAMED(recv_mode)) return recv_values[ch];
+	return recv_out[ch];
 }
 
 int16_t recv_get_ch(uint8_t ch)
 {
-	uint16_t recv = recv_readings[ch][cur_order[ch][get_config()->recv_samples/2]];
+	uint16_t recv = recv_raw(ch);
 	//return recv;
 	
 	if (recv == 0) return 0;
@@ -185,32 +536,116 @@ int16_t recv_get_ch(uint8_t ch)
 	return ((int16_t)recv - (int16_t)RECV_MID) * RECV_MULT / RECV_DENOM;
 }
 
+// O receptor está online se todos os canais receberam pulso nos últimos recv_timeout ms
+// e a mediana já saiu do zero
 uint8_t recv_online()
 {
-	return recv_readings[0][cur_order[0][get_config()->recv_samples/2]] != 0;
+	if (input_fault) return 0;
+	
+	uint32_t now = clock_now_us();
+	for (uint8_t i = 0; i < 5; i++)
+		if (now - recv_last_us[i] > recv_timeout_us) return 0;
+	
+	return recv_raw(0) != 0;
+}
+
+// Na quadratura a contagem tem sinal e é 4 vezes maior, então a escala vira 11/32
+// As divisões por enc_frames são as mais caras do tick: uns 200 ciclos cada na de
+// 16 bits e uns 600 na de 32 bits (o AVR não divide em hardware). Na build
+// especializada com ENC_FRAMES=8 elas viram shifts de uns 10 a 20 ciclos
+static int16_t enc_rate(int16_t v)
+{
+	if (enc_rate_scale == 256) return v;
+	return (int32_t)v * enc_rate_scale >> 8;
 }
 
-uint16_t enc_left()
+int16_t enc_left()
 {
-	return avg_frames_l / get_config()->enc_frames * 11 / 8;
+	if (enc_quad) return enc_rate((int32_t)(int16_t)avg_frames_l * 11 / (32 * CFG_ENC_FRAMES));
+	return enc_rate(avg_frames_l / CFG_ENC_FRAMES * 11 / 8);
 }
 
-uint16_t enc_right()
+int16_t enc_right()
 {
-	return avg_frames_r / get_config()->enc_frames * 11 / 8;
+	if (enc_quad) return enc_rate((int32_t)(int16_t)avg_frames_r * 11 / (32 * CFG_ENC_FRAMES));
+	return enc_rate(avg_frames_r / CFG_ENC_FRAMES * 11 / 8);
+}
+
+// Velocidade pelo estimador escolhido em enc_estimator, em 16.16 e com as mesmas
+// unidades de enc_left()/enc_right()
+int32_t enc_speed_left()
+{
+	if (enc_mt) return mt_l.speed;
+	return (int32_t)enc_left() * 65536L;
+}
+
+int32_t enc_speed_right()
+{
+	if (enc_mt) return mt_r.speed;
+	return (int32_t)enc_right() * 65536L;
 }
 
 // Interrupt do receptor
+// Roda inteiro com os interrupts desligados: é curto o suficiente para não
+// atrasar os encoders e não abre janela para perder bordas
 ISR (PCINT1_vect)
 {
-	uint16_t cur_ticks;
-	((uint8_t*)&cur_ticks)[0] = TCNT0;
-	((uint8_t*)&cur_ticks)[1] = overflow_count_v;
-
-	PCICR = 0;
-	sei();
+	LOAD_ISR();
+	uint16_t cur_ticks = clock_ticks();
+	
+	// Modo paralelo: cada pino que mudou desde a última foto do PORTC é tratado
+	// sozinho, então os canais podem chegar juntos ou em qualquer ordem
+	if (recv_mode == RECV_MODE_PWM_PARALLEL)
+	{
+		uint8_t port = PINC & B1111;
+		uint8_t changed = port ^ last_port;
+		last_port = port;
+		
+		uint8_t mask = B1;
+		for (uint8_t i = 0; i < 4; i++, mask <<= 1)
+			if (changed & mask)
+			{
+				if (port & mask) last_times[i][0] = cur_ticks;
+				else
+				{
+					last_times[i][1] = cur_ticks;
+					flags |= RECV_AVAL0 << i;
+				}
+			}
+		
+		return;
+	}
+	
+	// PPM: só as subidas do PC0 interessam
+	if (recv_mode == RECV_MODE_PPM)
+	{
+		if (!(PINC & B1)) return;
+		
+		uint16_t width = cur_ticks - ppm_last;
+		ppm_last = cur_ticks;
+		
+		if (width > PPM_SYNC)
+		{
+			if (ppm_ch >= PPM_MIN_CHANNELS && ppm_ch <= RCBUS_MAX_CHANNELS)
+			{
+				for (uint8_t i = 0; i < ppm_ch; i++)
+					ppm_frame[i] = ppm_work[i];
+				ppm_count = ppm_ch;
+				flags |= RECV_AVAL0;
+			}
+			ppm_ch = 0;
+		}
+		else if (ppm_ch < RCBUS_MAX_CHANNELS)
+		{
+			// Um canal fora da faixa invalida o frame inteiro até o próximo sync
+			if (width < PPM_MIN || width > PPM_MAX) ppm_ch = RCBUS_MAX_CHANNELS + 1;
+			else ppm_work[ppm_ch++] = width;
+		}
+		else ppm_ch = RCBUS_MAX_CHANNELS + 1;
+		
+		return;
+	}
 	
-	wdt_reset();
 	uint8_t cur_read = (PINC & (cur_flag)) != 0;
 	
 	if (cur_read && !last_read)
@@ -237,22 +672,14 @@ ISR (PCINT1_vect)
 	}
 	
 	last_read = cur_read;
-	
-	cli();
-	PCICR = B110;
 }
 
 // Interrupt especial do canal do ESC
 ISR (PCINT2_vect)
 {
-	uint16_t cur_ticks;
-	((uint8_t*)&cur_ticks)[0] = TCNT0;
-	((uint8_t*)&cur_ticks)[1] = overflow_count_v;
-	
-	PCICR = 0;
-	sei();
+	LOAD_ISR();
+	uint16_t cur_ticks = clock_ticks();
 	
-	wdt_reset();
 	uint8_t cur_read_d = (PIND & _BV(7)) != 0;
 	if (cur_read_d && !last_read_d)
 		last_times[4][0] = cur_ticks;
@@ -263,8 +690,5 @@ ISR (PCINT2_vect)
 	}
 	
 	last_read_d = cur_read_d;
-	
-	cli();
-	PCICR = B110;
 }
 
@@ -0,0 +1,120 @@
+//
+// load.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem o medidor de carga da CPU. A cada janela de
+// LOAD_WINDOW_FRAMES frames (262 ms) o tempo é dividido em:
+//   - interrupts: os ISRs em C marcam o TCNT1 na entrada e somam a
+//     duração na saída (LOAD_ISR(), ver default.h), mais uma estimativa
+//     do prólogo e do epílogo. Os ISRs dos encoders (enc.S) não são
+//     medidos, para não ficarem mais lentos: o custo deles vem do
+//     número de bordas contadas vezes os ciclos documentados no enc.S
+//   - ocioso: o tempo dormindo em load_idle(), menos os interrupts que
+//     rodaram nesse meio tempo
+//   - tarefas: o resto (as tarefas e o próprio loop principal)
+// As porcentagens são dadas em milésimos, e a maior ocupação (tarefas
+// mais interrupts) já vista também é guardada
+//
+
+#include "default.h"
+
+#define LOAD_WINDOW_FRAMES 32
+
+// Ciclos por borda nos interrupts dos encoders, os contados pelo make
+// bench-asm (ver enc.S); na quadratura é a média entre o INT0/INT1 e o PCINT0
+#define ENC_EDGE_CYCLES 43
+#define ENC_EDGE_CYCLES_QUAD 87
+
+// Duração dos ISRs em C, em ticks de 0,5 us (só muda dentro dos ISRs)
+volatile uint16_t load_isr_ticks = 0;
+
+static uint16_t last_isr_ticks = 0;
+static uint32_t window_start_us = 0;
+static uint32_t idle_us = 0, isr_us = 0, enc_cycles = 0;
+static uint8_t window_frames = 0;
+static load_stats_struct stats;
+
+void load_init()
+{
+	window_start_us = clock_now_us();
+	last_isr_ticks = load_isr_ticks;
+}
+
+// Dorme até o próximo interrupt, se não houver tarefa liberada, e conta o tempo
+void load_idle()
+{
+	cli();
+	if (sched_released())
+	{
+		sei();
+		return;
+	}
+
+	uint32_t t0 = clock_now_us();
+	uint16_t isr0 = load_isr_ticks;
+
+	// O sei só tem efeito depois da instrução seguinte: nenhum interrupt
+	// pode liberar uma tarefa entre a verificação e o sleep
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	// Aqui o interrupt que acordou a CPU já rodou
+	uint32_t t1 = clock_now_us();
+	cli();
+	uint16_t isr1 = load_isr_ticks;
+	sei();
+
+	uint16_t isr = (uint16_t)(isr1 - isr0) >> 1;
+	uint32_t slept = t1 - t0;
+	if (slept > isr) idle_us += slept - isr;
+}
+
+// Soma as bordas dos encoders de um tick de controle
+void load_count_edges(uint16_t edges)
+{
+	enc_cycles += (uint32_t)edges * (get_config()->enc_quadrature ? ENC_EDGE_CYCLES_QUAD : ENC_EDGE_CYCLES);
+}
+
+// Chamada a cada frame: fecha a janela a cada LOAD_WINDOW_FRAMES frames
+void load_update()
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = load_isr_ticks;
+	SREG = sreg;
+	isr_us += (uint16_t)(ticks - last_isr_ticks) >> 1;
+	last_isr_ticks = ticks;
+
+	if (++window_frames < LOAD_WINDOW_FRAMES) return;
+	window_frames = 0;
+
+	uint32_t now = clock_now_us();
+	uint32_t window = now - window_start_us;
+	window_start_us = now;
+
+	// As bordas dos encoders acordam a CPU, então a maior parte delas cai no tempo
+	// ocioso medido
+	uint32_t enc_us = enc_cycles / (F_CPU / 1000000UL);
+	uint32_t isr = isr_us + enc_us;
+	if (isr > window) isr = window;
+	uint32_t idle = idle_us > enc_us ? idle_us - enc_us : 0;
+	if (idle + isr > window) idle = isr < window ? window - isr : 0;
+
+	stats.isr_pm = isr * 1000 / window;
+	stats.idle_pm = idle * 1000 / window;
+	stats.task_pm = 1000 - stats.isr_pm - stats.idle_pm;
+	stats.window_ms = window / 1000;
+	if (1000 - stats.idle_pm > stats.busy_max_pm) stats.busy_max_pm = 1000 - stats.idle_pm;
+
+	idle_us = isr_us = enc_cycles = 0;
+}
+
+const load_stats_struct* load_get_stats()
+{
+	return &stats;
+}
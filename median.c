@@ -0,0 +1,157 @@
+//
+// median.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo implementa a mediana de janela deslizante usada
+// no filtro dos receptores. A estrutura é um par de heaps (um
+// max-heap com a metade de baixo e um min-heap com a metade de
+// cima) que compartilham a raiz, que é a própria mediana
+//
+// O vetor heap é indexado de -(n-1)/2 até (n-1)/2: os índices
+// negativos formam o max-heap, os positivos o min-heap e o 0 é
+// a mediana. pos[] guarda, para cada amostra, onde ela está no
+// heap, então a amostra mais antiga é achada sem busca nenhuma
+//
+// Cada atualização faz no máximo uma subida e duas descidas nos
+// heaps, ou seja, no máximo 3*log2((n+1)/2) trocas (12 para n=31),
+// e a leitura da mediana é só data[heap[0]]
+//
+// Os três vetores ficam na arena (ver arena.c), com o tamanho exato
+// da janela: MEDIAN_BYTES(n) bytes. A janela tem que ser ímpar: com n
+// par um item do min-heap ficaria fora dos índices -(n-1)/2..(n-1)/2
+//
+
+#include "default.h"
+
+// No build do computador as comparações e as trocas são contadas, para o
+// benchmark de test/median.c
+#ifdef HOST
+uint32_t median_compares, median_exchanges;
+#define MEDIAN_COUNT(v) ((v)++)
+#else
+#define MEDIAN_COUNT(v) ((void)0)
+#endif
+
+#define HEAP(m,i) ((m)->heap[(i)])
+#define LESS(m,i,j) (MEDIAN_COUNT(median_compares), (m)->data[HEAP(m,i)] < (m)->data[HEAP(m,j)])
+
+// Troca os itens i e j do heap, mantendo os ponteiros de volta
+static void median_exchange(median_filter *m, int8_t i, int8_t j)
+{
+	uint8_t t = HEAP(m,i);
+	MEDIAN_COUNT(median_exchanges);
+	HEAP(m,i) = HEAP(m,j);
+	HEAP(m,j) = t;
+	m->pos[HEAP(m,i)] = i;
+	m->pos[HEAP(m,j)] = j;
+}
+
+// Troca i e j caso o item i seja menor que o j
+static uint8_t median_cmp_exchange(median_filter *m, int8_t i, int8_t j)
+{
+	if (!LESS(m,i,j)) return 0;
+	median_exchange(m, i, j);
+	return 1;
+}
+
+// Mantém a propriedade do min-heap para todos os itens abaixo de i/2
+static void median_min_sort_down(median_filter *m, int8_t i)
+{
+	int8_t ct = m->half;
+	for (; i <= ct; i *= 2)
+	{
+		if (i > 1 && i < ct && LESS(m, i+1, i)) i++;
+		if (!median_cmp_exchange(m, i, i/2)) break;
+	}
+}
+
+// Mantém a propriedade do max-heap para todos os itens abaixo de i/2
+static void median_max_sort_down(median_filter *m, int8_t i)
+{
+	int8_t ct = -m->half;
+	for (; i >= ct; i *= 2)
+	{
+		if (i < -1 && i > ct && LESS(m, i, i-1)) i--;
+		if (!median_cmp_exchange(m, i/2, i)) break;
+	}
+}
+
+// Sobe o item i no min-heap, retorna 1 se ele chegou na mediana
+static uint8_t median_min_sort_up(median_filter *m, int8_t i)
+{
+	while (i > 0 && median_cmp_exchange(m, i, i/2)) i /= 2;
+	return i == 0;
+}
+
+// Sobe o item i no max-heap, retorna 1 se ele chegou na mediana
+static uint8_t median_max_sort_up(median_filter *m, int8_t i)
+{
+	while (i < 0 && median_cmp_exchange(m, i/2, i)) i /= 2;
+	return i == 0;
+}
+
+// Aloca as janelas na arena; retorna 0 se não houver espaço ou se a janela
+// não for ímpar entre 1 e MEDIAN_MAX_SAMPLES
+uint8_t median_alloc(median_filter *m, uint8_t samples)
+{
+	if (samples % 2 == 0 || samples > MEDIAN_MAX_SAMPLES) return 0;
+
+	uint8_t *buf = arena_alloc(MEDIAN_BYTES(samples));
+	if (!buf) return 0;
+
+	m->half = (samples-1)/2;
+	m->samples = samples;
+	m->data = (uint16_t*)buf;
+	m->pos = (int8_t*)(buf + 2*samples);
+	m->heap = buf + 3*samples + m->half;
+	return 1;
+}
+
+void median_init(median_filter *m)
+{
+	uint8_t samples = m->samples;
+	m->cur = 0;
+
+	// Todas as amostras começam em 0, então qualquer ordem é um heap válido
+	for (uint8_t j = 0; j < samples; j++)
+	{
+		int8_t p = (int8_t)j - m->half;
+		m->data[j] = 0;
+		m->pos[j] = p;
+		HEAP(m,p) = j;
+	}
+}
+
+void median_insert(median_filter *m, uint16_t value)
+{
+	uint8_t cur = m->cur;
+	int8_t p = m->pos[cur];
+	uint16_t old = m->data[cur];
+	m->data[cur] = value;
+	if (++cur == m->samples) cur = 0;
+	m->cur = cur;
+
+	if (p > 0) // a amostra nova está no min-heap
+	{
+		if (old < value) median_min_sort_down(m, p*2);
+		else if (median_min_sort_up(m, p)) median_max_sort_down(m, -1);
+	}
+	else if (p < 0) // a amostra nova está no max-heap
+	{
+		if (value < old) median_max_sort_down(m, p*2);
+		else if (median_max_sort_up(m, p)) median_min_sort_down(m, 1);
+	}
+	else if (m->half) // a amostra nova é a mediana
+	{
+		if (median_max_sort_up(m, -1)) median_max_sort_down(m, -2);
+		if (median_min_sort_up(m, 1)) median_min_sort_down(m, 2);
+	}
+}
+
+uint16_t median_get(const median_filter *m)
+{
+	return m->data[HEAP(m,0)];
+}
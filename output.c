@@ -11,21 +11,18 @@
 
 #include "default.h"
 
-#define MOTOR_MAX_POWER 250
-#define MOTOR_MIN_POWER 8
-
 static volatile uint8_t esc_power = 123;
 
 void motor_set_power_left(int16_t power)
 {
-	CLAMP(power, MOTOR_MAX_POWER);
+	power = motor_power(power);
 	
-	if (power >= MOTOR_MIN_POWER)
+	if (power > 0)
 	{
 		OCR0A = power;
 		OCR0B = 0;
 	}
-	else if (power <= -MOTOR_MIN_POWER)
+	else if (power < 0)
 	{
 		OCR0A = 0;
 		OCR0B = -power;
@@ -37,30 +34,40 @@ void motor_set_power_left(int16_t power)
 	}
 }
 
+// O Timer1 tem TOP em 2047 (ver main.c), então a potência é multiplicada por 8.
+// Os registradores de 16 bits compartilham o byte TEMP com a leitura do TCNT1
+// feita nos interrupts do receptor, por isso a escrita é feita sem interrupts
 void motor_set_power_right(int16_t power)
 {
-	CLAMP(power, MOTOR_MAX_POWER);
+	uint16_t ocra, ocrb;
+	power = motor_power(power);
 	
-	if (power >= MOTOR_MIN_POWER)
+	if (power > 0)
 	{
-		OCR1AL = power;
-		OCR1BL = 0;
+		ocra = (uint16_t)power << 3;
+		ocrb = 0;
 	}
-	else if (power <= -MOTOR_MIN_POWER)
+	else if (power < 0)
 	{
-		OCR1AL = 0;
-		OCR1BL = -power;
+		ocra = 0;
+		ocrb = (uint16_t)-power << 3;
 	}
 	else
 	{
-		OCR1AL = 0;
-		OCR1BL = 0;
+		ocra = 0;
+		ocrb = 0;
 	}
+	
+	uint8_t sreg = SREG;
+	cli();
+	OCR1A = ocra;
+	OCR1B = ocrb;
+	SREG = sreg;
 }
 
 void esc_set_power(int16_t power)
 {
-	CLAMP(power, 244);
+	CLAMP(power, ESC_MAX_POWER);
 	esc_power = 123 + power;
 	flags |= ESC_AVAILABLE;
 }
@@ -79,6 +86,7 @@ ISR (TIMER2_COMPA_vect, ISR_NAKED)
 
 ISR (TIMER2_OVF_vect)
 {
+	LOAD_ISR();
 	static uint8_t counter = 1;
 	switch (counter)
 	{
@@ -0,0 +1,217 @@
+//
+// rcbus.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem a leitura de receptores digitais pela USART
+// (SBUS e iBUS). O interrupt só guarda os bytes num buffer circular,
+// e o parser roda no loop principal, byte a byte, montando o frame
+// e convertendo os canais para a mesma escala dos pulsos PWM
+// (ticks de 0,5 us, com o centro em RECV_MID)
+//
+// SBUS: 100000 baud, 8E2, sinal invertido (precisa de um inversor
+// externo no RX), 25 bytes por frame, 16 canais de 11 bits
+// iBUS: 115200 baud, 8N1, 32 bytes por frame, 14 canais de 16 bits
+//
+// Os dois mandam um frame a cada 7 ms ou mais, então entre os frames há
+// uns 4 ms de silêncio. O SBUS não tem checksum, e o cabeçalho (0x0F)
+// também aparece no meio dos canais: um frame SBUS só começa num byte
+// que chegou depois desse intervalo. O iBUS procura o cabeçalho em
+// qualquer lugar, e um frame falso é pego pelo checksum
+//
+
+#include "default.h"
+
+#define SBUS_FRAME_SIZE 25
+#define SBUS_HEADER 0x0F
+#define SBUS_FOOTER 0x00
+#define SBUS_FLAGS_FAILSAFE _BV(3)
+#define SBUS_CHANNELS 16
+
+#define IBUS_FRAME_SIZE 32
+#define IBUS_HEADER0 0x20
+#define IBUS_HEADER1 0x40
+#define IBUS_CHANNELS 14
+
+#define SBUS_BAUD_PRESCALE ((F_CPU + 100000UL * 8) / (100000UL * 16) - 1)
+#define IBUS_BAUD_PRESCALE ((F_CPU + 115200UL * 4) / (115200UL * 8) - 1) // U2X, 2,1% de erro
+
+#define RCBUS_BUFFER_SIZE 64 // potência de 2, mais de 5 ms de bytes
+#define RCBUS_BUFFER_MASK (RCBUS_BUFFER_SIZE-1)
+
+// Um silêncio maior que isso separa dois frames: são mais de 8 bytes, e o
+// intervalo entre os frames é de uns 4 ms
+#define RCBUS_GAP_TICKS 2000 // 1 ms
+
+static volatile uint8_t rx_buffer[RCBUS_BUFFER_SIZE];
+// Um bit por posição do buffer: o byte chegou depois de um silêncio
+static volatile uint8_t rx_gap[RCBUS_BUFFER_SIZE / 8];
+// rx_head aponta para onde o interrupt escreve, rx_tail para onde o parser lê
+static volatile uint8_t rx_head = 0, rx_tail = 0, rx_error = 0;
+// Instante do último byte, em ticks de 0,5 us (ver clock_ticks())
+static uint16_t rx_last_ticks;
+
+static uint8_t mode;
+static uint8_t frame[IBUS_FRAME_SIZE];
+static uint8_t frame_pos = 0;
+
+// Interrupt de recepção: só guarda o byte e avisa o loop principal
+ISR (USART_RX_vect)
+{
+	LOAD_ISR();
+	uint8_t status = UCSR0A;
+	uint8_t byte = UDR0;
+	uint16_t now = clock_ticks();
+	uint8_t gap = (uint16_t)(now - rx_last_ticks) > RCBUS_GAP_TICKS;
+	rx_last_ticks = now;
+
+	// Erro de paridade ou de frame: o parser tem que se ressincronizar
+	if (status & (_BV(FE0) | _BV(UPE0))) rx_error = 1;
+	else
+	{
+		uint8_t head = rx_head;
+		uint8_t next = (head + 1) & RCBUS_BUFFER_MASK;
+		if (next != rx_tail)
+		{
+			rx_buffer[head] = byte;
+			if (gap) rx_gap[head >> 3] |= _BV(head & 7);
+			else rx_gap[head >> 3] &= ~_BV(head & 7);
+			rx_head = next;
+		}
+		else rx_error = 1;
+	}
+
+	flags |= RECV_AVAL0;
+}
+
+void rcbus_init(uint8_t recv_mode)
+{
+	mode = recv_mode;
+	frame_pos = 0;
+	rx_head = rx_tail = rx_error = 0;
+	rx_last_ticks = clock_now_us() << 1;
+
+	if (mode == RECV_MODE_SBUS)
+	{
+		UCSR0A = 0;
+		UBRR0 = SBUS_BAUD_PRESCALE;
+		UCSR0C = _BV(UPM01) | _BV(USBS0) | _BV(UCSZ01) | _BV(UCSZ00); // 8E2
+	}
+	else
+	{
+		UCSR0A = _BV(U2X0);
+		UBRR0 = IBUS_BAUD_PRESCALE;
+		UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); // 8N1
+	}
+
+	// O TX continua ligado
+	UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+}
+
+// Converte um valor em us (centro em 1500) para ticks de 0,5 us centrados em RECV_MID
+#define US_TO_TICKS(us) ((uint16_t)(RECV_MID + ((int16_t)(us) - 1500) * 2))
+
+// O parser é dividido em rcbus_push(), por byte, e nos decodificadores, por frame,
+// fora de linha para o make bench-isr contar os ciclos de cada um e somar o custo
+// de um frame inteiro (ver FRAMES no cycles.py)
+static uint8_t sbus_decode(uint16_t *channels) __attribute__((noinline));
+static uint8_t ibus_decode(uint16_t *channels) __attribute__((noinline));
+static uint8_t rcbus_push(uint8_t tail) __attribute__((noinline));
+
+static uint8_t sbus_decode(uint16_t *channels)
+{
+	if (frame[SBUS_FRAME_SIZE-1] != SBUS_FOOTER) return 0;
+	if (frame[SBUS_FRAME_SIZE-2] & SBUS_FLAGS_FAILSAFE) return 0;
+
+	// 16 canais de 11 bits, LSB primeiro, nos bytes 1 a 22
+	uint32_t bits = 0;
+	uint8_t nbits = 0, ch = 0;
+	for (uint8_t i = 1; i < SBUS_FRAME_SIZE-2; i++)
+	{
+		bits |= (uint32_t)frame[i] << nbits;
+		nbits += 8;
+		if (nbits >= 11)
+		{
+			// 172..1811 corresponde a 988..2012 us, com o centro em 992
+			int16_t v = bits & 0x7FF;
+			channels[ch++] = RECV_MID + (v - 992) * 5 / 4;
+			bits >>= 11;
+			nbits -= 11;
+		}
+	}
+
+	return SBUS_CHANNELS;
+}
+
+static uint8_t ibus_decode(uint16_t *channels)
+{
+	uint16_t sum = 0xFFFF;
+	for (uint8_t i = 0; i < IBUS_FRAME_SIZE-2; i++)
+		sum -= frame[i];
+	if (sum != (frame[IBUS_FRAME_SIZE-2] | ((uint16_t)frame[IBUS_FRAME_SIZE-1] << 8))) return 0;
+
+	for (uint8_t ch = 0; ch < IBUS_CHANNELS; ch++)
+	{
+		uint16_t us = frame[2+2*ch] | ((uint16_t)(frame[3+2*ch] & 0x0F) << 8);
+		channels[ch] = US_TO_TICKS(us);
+	}
+
+	return IBUS_CHANNELS;
+}
+
+// Põe o byte da posição tail do buffer no frame; retorna 1 se ele completou o frame
+static uint8_t rcbus_push(uint8_t tail)
+{
+	uint8_t byte = rx_buffer[tail];
+	uint8_t gap = rx_gap[tail >> 3] & _BV(tail & 7);
+
+	// Um byte depois do silêncio começa um frame: o que sobrou de um frame
+	// incompleto (depois de um erro, por exemplo) é descartado
+	if (gap) frame_pos = 0;
+
+	// Sincronização pelo cabeçalho
+	if (frame_pos == 0)
+	{
+		if (mode == RECV_MODE_SBUS ? !gap || byte != SBUS_HEADER : byte != IBUS_HEADER0) return 0;
+	}
+	else if (frame_pos == 1 && mode == RECV_MODE_IBUS && byte != IBUS_HEADER1)
+	{
+		// O byte pode ser o começo do frame de verdade (20 20 40 ...)
+		frame_pos = 0;
+		if (byte != IBUS_HEADER0) return 0;
+	}
+
+	frame[frame_pos++] = byte;
+	if (frame_pos < (mode == RECV_MODE_SBUS ? SBUS_FRAME_SIZE : IBUS_FRAME_SIZE)) return 0;
+	frame_pos = 0;
+	return 1;
+}
+
+// Consome os bytes recebidos. Retorna o número de canais escritos em
+// channels se pelo menos um frame válido foi completado, ou 0
+uint8_t rcbus_read(uint16_t *channels)
+{
+	uint8_t result = 0;
+
+	if (rx_error)
+	{
+		rx_error = 0;
+		frame_pos = 0;
+	}
+
+	while (rx_tail != rx_head)
+	{
+		uint8_t tail = rx_tail;
+		rx_tail = (tail + 1) & RCBUS_BUFFER_MASK;
+
+		if (rcbus_push(tail))
+		{
+			uint8_t n = mode == RECV_MODE_SBUS ? sbus_decode(channels) : ibus_decode(channels);
+			if (n) result = n;
+		}
+	}
+
+	return result;
+}
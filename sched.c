@@ -0,0 +1,220 @@
+//
+// sched.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem o escalonador cooperativo do loop principal e a
+// contabilidade de tempo de cada tarefa. As tarefas ficam numa tabela
+// (em main.c) na ordem de prioridade; sched_run() roda só a primeira
+// tarefa liberada e volta, então depois de cada tarefa a procura começa
+// de novo pelo controle, que nunca espera mais que uma tarefa
+//
+// As tarefas não periódicas (receptor e telemetria) só rodam se o seu
+// budget_us couber no tempo que falta para a próxima liberação do
+// controle; senão esperam o controle rodar. A telemetria já é dividida
+// em pedaços pequenos (um byte por vez), e o receptor é curto
+//
+// SCHED_CONTROL (encoders, PID e motores) roda no período configurado
+// em control_period, de 1 a 10 ms. A base de tempo é o comparador B
+// do Timer2, que conta em ticks de 4 us e é livre (o ESC só usa o
+// overflow e o comparador A), então a taxa do controle não depende da
+// frequência do PWM dos motores. Como o Timer2 tem 8 bits, o período é
+// dividido em passos de 100 a 200 ticks, e só o último passo libera a
+// tarefa; a liberação tem resolução de 4 us e não acumula erro
+//
+// SCHED_FRAME (watchdog, LED, ESC e failsafe) continua no tick de
+// 8192 us do TIMER1_OVF_vect (ver clock.c), porque as rampas do ESC e
+// do failsafe são contadas nesses frames
+//
+// Para cada tarefa são medidos o atraso entre a liberação e o começo
+// (o jitter), o tempo de execução, as liberações perdidas (a anterior
+// ainda não tinha começado) e os estouros de prazo (a execução terminou
+// depois da próxima liberação)
+//
+
+#include "default.h"
+
+#define SCHED_TICK_US 4
+#define SCHED_MAX_STEP 200
+
+#define SAT_INC(v) do { if ((v) != 0xFFFF) (v)++; } while (0)
+
+// Liberações perdidas, contadas nos interrupts
+volatile uint16_t sched_skips[SCHED_NUM_TASKS];
+
+static sched_stats_struct stats[SCHED_NUM_TASKS];
+static uint32_t release_us[SCHED_NUM_TASKS], start_us[SCHED_NUM_TASKS];
+static uint16_t period_us[SCHED_NUM_TASKS];
+
+// Estado do Timer2: ticks que faltam até a próxima liberação do controle
+static uint16_t control_ticks;
+static uint16_t control_remaining;
+static volatile uint8_t control_pending = 0;
+static volatile uint32_t control_release_us;
+
+ISR (TIMER2_COMPB_vect)
+{
+	LOAD_ISR();
+	
+	if (control_remaining == 0)
+	{
+		if (control_pending) sched_skips[SCHED_CONTROL]++;
+		control_pending = 1;
+		control_release_us = clock_now_us();
+		control_remaining = control_ticks;
+	}
+
+	// Passos grandes o suficiente para o OCR2B nunca ficar para trás do TCNT2
+	uint16_t step = control_remaining;
+	if (step > SCHED_MAX_STEP) step = step > 2*SCHED_MAX_STEP ? SCHED_MAX_STEP : step/2;
+	OCR2B += (uint8_t)step;
+	control_remaining -= step;
+}
+
+// Período do controle em us, já validado (pode ser chamada antes de sched_init())
+uint16_t sched_control_period()
+{
+	uint16_t period = get_config()->control_period;
+	if (period < CONTROL_PERIOD_MIN || period > CONTROL_PERIOD_MAX) period = CONTROL_PERIOD_DEFAULT;
+	return period;
+}
+
+void sched_init()
+{
+	uint16_t period = sched_control_period();
+
+	period_us[SCHED_CONTROL] = period;
+	period_us[SCHED_FRAME] = 8192;
+	control_ticks = period / SCHED_TICK_US;
+	control_remaining = control_ticks;
+	control_pending = 0;
+
+	for (uint8_t i = 0; i < SCHED_NUM_TASKS; i++)
+	{
+		memset(&stats[i], 0, sizeof(sched_stats_struct));
+		sched_skips[i] = 0;
+	}
+
+	OCR2B = TCNT2 + SCHED_MAX_STEP;
+	control_remaining -= SCHED_MAX_STEP;
+	// O interrupt da comparação B já é habilitado no main()
+	TIFR2 = _BV(OCF2B);
+}
+
+// Há tarefa liberada por interrupt? Chamada com os interrupts desligados, antes de
+// dormir (a telemetria não tem interrupt, e espera o próximo)
+uint8_t sched_released()
+{
+	return control_pending || (flags & (EXECUTE_ENC|EXECUTE_RECV));
+}
+
+// Tempo até a próxima liberação do controle, em us
+static uint16_t sched_slack_us()
+{
+	uint16_t ticks;
+	uint8_t sreg = SREG;
+	cli();
+	if (control_pending) ticks = 0;
+	else if (TIFR2 & _BV(OCF2B)) ticks = control_remaining;
+	else ticks = (uint8_t)(OCR2B - TCNT2) + control_remaining;
+	SREG = sreg;
+	return ticks * SCHED_TICK_US;
+}
+
+// Retorna 1 se a tarefa foi liberada, e começa a contar o tempo dela
+static uint8_t sched_begin(uint8_t task)
+{
+	uint32_t release, now;
+
+	if (task == SCHED_CONTROL)
+	{
+		if (!control_pending) return 0;
+		uint8_t sreg = SREG;
+		cli();
+		release = control_release_us;
+		control_pending = 0;
+		SREG = sreg;
+		now = clock_now_us();
+	}
+	else if (task == SCHED_FRAME)
+	{
+		if (!(flags & EXECUTE_ENC)) return 0;
+		flags &= (uint8_t)~EXECUTE_ENC;
+		// O TIMER1_OVF_vect libera o frame nos múltiplos de 8192 us
+		now = clock_now_us();
+		release = now & ~8191UL;
+	}
+	else
+	{
+		// As outras tarefas são liberadas por eventos sem carimbo de tempo
+		if (task == SCHED_RECV ? !(flags & EXECUTE_RECV) : !telemetry_ready()) return 0;
+		now = release = clock_now_us();
+	}
+
+	sched_stats_struct *st = &stats[task];
+	if (SCHED_PERIODIC(task))
+	{
+		uint32_t latency = now - release;
+		if (latency > 4095) latency = 4095; // a média é x16 em 16 bits
+		if (latency > st->latency_max) st->latency_max = latency;
+		st->latency_avg += ((int16_t)(((uint16_t)latency << 4) - st->latency_avg)) >> 4;
+	}
+	st->releases++;
+
+	release_us[task] = release;
+	start_us[task] = now;
+	return 1;
+}
+
+static void sched_end(uint8_t task, uint16_t budget)
+{
+	sched_stats_struct *st = &stats[task];
+	uint32_t now = clock_now_us();
+
+	// O prazo é a próxima liberação
+	if (SCHED_PERIODIC(task) && now - release_us[task] > period_us[task]) SAT_INC(st->overruns);
+	uint32_t exec = now - start_us[task];
+	st->cpu_us += exec;
+	if (exec > budget) SAT_INC(st->over_budget);
+	if (exec > 0xFFFF) exec = 0xFFFF;
+	if (exec > st->exec_max) st->exec_max = exec;
+}
+
+// Roda a tarefa liberada de maior prioridade; retorna 0 se não havia nenhuma
+uint8_t sched_run(const sched_task *tasks)
+{
+	for (uint8_t i = 0; i < SCHED_NUM_TASKS; i++)
+	{
+		if (!SCHED_PERIODIC(i) && sched_slack_us() < tasks[i].budget_us)
+		{
+			// Só conta se a tarefa estava mesmo esperando
+			if (i == SCHED_RECV ? (flags & EXECUTE_RECV) : telemetry_ready())
+				SAT_INC(stats[i].deferrals);
+			return 0;
+		}
+
+		if (sched_begin(i))
+		{
+			tasks[i].run();
+			sched_end(i, tasks[i].budget_us);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Foto das estatísticas, para a telemetria
+void sched_get_stats(sched_stats_struct *dst)
+{
+	for (uint8_t i = 0; i < SCHED_NUM_TASKS; i++)
+	{
+		uint8_t sreg = SREG;
+		cli();
+		stats[i].skips = sched_skips[i];
+		SREG = sreg;
+		dst[i] = stats[i];
+	}
+}
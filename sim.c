@@ -0,0 +1,605 @@
+//
+// sim.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo é o simulador do robô em malha fechada, para ajustar
+// os ganhos do PID no computador em vez de uma gravação da EEPROM
+// por vez. Ele liga o núcleo de controle de verdade (make host, ver
+// hal.h) a um modelo do robô:
+//   - tração diferencial: massa e inércia de giro do robô, resistência
+//     ao rolamento e arrasto lateral das rodas no giro
+//   - motores DC com redução, sem a indutância (a constante elétrica
+//     é bem menor que o passo do controle); o PWM vira a tensão média
+//   - encoders de ENC_EDGES_PER_REV bordas por volta do motor, com as
+//     bordas entregues ao INT0/INT1 no microssegundo em que acontecem
+//   - receptor PWM com os pulsos em sequência no PORTC (e o canal da
+//     arma no PD7), com larguras em us inteiros e jitter no período
+//   - bateria com resistência interna, que cai com a corrente dos
+//     motores e da arma
+// O tempo de execução das tarefas não é simulado (elas rodam em tempo
+// zero), só o momento em que são liberadas
+//
+// Cada cenário é um degrau nos sticks; para cada lado é medido, nas
+// unidades de enc_left() e contra o alvo do mixer, o tempo de subida
+// (10% a 90%), o sobressinal, o tempo de acomodação (faixa de 5%) e o
+// erro em regime (média dos últimos 250 ms), além da menor tensão da
+// bateria. No cenário travado as rodas ficam presas (contra o oponente)
+// com o stick já no meio, e são soltas no degrau: as medidas são a
+// recuperação do travamento. No cenário sem-sinal o receptor sai do ar
+// no degrau, com o robô andando e a arma ligada: as medidas são a
+// parada pelo failsafe (ver failsafe_control() em control.c). Uso: host/sim [-m pid_mode] [-f] [-t cenário
+// | -l] [kp ki kd], com os ganhos em ponto flutuante e o PID_MODE_* (o
+// padrão é o PID_MODE_INCREMENTAL); -f liga o feedforward. Sem os ganhos,
+// valem os de sim_gains, ajustados para este modelo, e não os da
+// configuração padrão (1 0 0): o modelo não é o robô, e com ela ele dá uns
+// 80% de sobressinal no modo 0 e uns 50% de erro em regime nos posicionais,
+// que só têm o P. Com -t, em vez das medidas sai o traço do
+// cenário, em CSV, a cada SIM_SAMPLE_US, e com -l sai a distribuição da
+// latência do stick à saída (ver run_latency()) para cada canal,
+// recv_samples e enc_frames. host/sim -c mede a velocidade em regime do
+// robô andando reto para cada PWM, e mostra a tabela do feedforward
+// (ver ff_table em control.c) para esse modelo
+//
+
+#include "default.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SIM_STEP_US 1
+#define SIM_STEP_TIME 1.5   // s, instante do degrau
+#define SIM_END_TIME 4.0    // s
+#define SIM_SAMPLE_US 1000
+#define SIM_SAMPLES 4000 // SIM_END_TIME / SIM_SAMPLE_US
+
+// Robô
+#define ROBOT_MASS 1.5       // kg
+#define ROBOT_INERTIA 0.012  // kg m², em torno do eixo vertical
+#define ROBOT_TRACK 0.15     // m, entre as rodas
+#define WHEEL_RADIUS 0.03    // m
+#define GEAR_RATIO 16.0
+#define ROLLING_FORCE 1.5    // N, no robô todo
+#define SCRUB_TORQUE 0.3     // N m, das rodas arrastando de lado no giro
+
+// Motores de tração: ~20000 rpm sem carga com 12 V
+#define MOTOR_R 0.5          // ohm
+#define MOTOR_KE 0.0057      // V s/rad, igual ao Kt em N m/A
+#define MOTOR_J 1e-6         // kg m², rotor
+#define MOTOR_PWM_TOP 255.0
+#define ENC_EDGES_PER_REV 64
+
+// Arma: motor com um disco pesado
+#define WEAPON_R 0.3
+#define WEAPON_KE 0.01
+#define WEAPON_J 2e-3
+
+// Bateria: 3S LiPo
+#define BATTERY_VOC 12.6
+#define BATTERY_R 0.05
+
+// Receptor: larguras em us, 1540 us é o RECV_MID
+#define RECV_FRAME_US 20000
+#define RECV_JITTER_US 50
+#define RECV_GAP_US 20
+#define RECV_ESC_START_US 10000
+
+// Unidades de enc_left(): bordas por 8192 us vezes 11/8
+#define SPEED_UNITS(w) ((w) * ENC_EDGES_PER_REV / (2*M_PI) * 0.008192 * 11 / 8)
+
+// Variáveis de control.c
+extern int32_t target_l, target_r;
+
+// Ganhos padrão do simulador (kp, ki e kd em 8.8), achados com varreduras nos
+// cenários de degrau: sobressinal de até uns 4% e erro em regime de até uns 2%.
+// As exceções são o travado no modo 0, em que o acumulado do travamento dá uns
+// 90% de sobressinal (os modos posicionais limitam o integrador), e o
+// frente-total, que satura. No PID_MODE_INCREMENTAL a saída acumula o
+// termo do kp, então ele faz o papel do I e o kd o do P
+static const uint16_t sim_gains[2][3] =
+{
+	{ 0x0018, 0x0000, 0x0100 }, // PID_MODE_INCREMENTAL
+	{ 0x0180, 0x0018, 0x0000 }, // PID_MODE_CLAMP e PID_MODE_BACK_CALC
+};
+
+static const sched_task tasks[SCHED_NUM_TASKS] =
+{
+	{ control_task, 500 },
+	{ frame_task, 150 },
+	{ recv_task, 300 },
+	{ telemetry_poll, 50 },
+};
+
+// Larguras dos 5 canais antes e depois do degrau. O canal 2 fica embaixo (sem
+// inverter), o 3 em cima (PID inteiro) e o 4 é a arma, com 1522 us no neutro.
+// Com stall, as rodas ficam presas até o degrau; com link_loss, o receptor para
+// de mandar pulsos no frame que começa depois do degrau (after não é usado)
+typedef struct
+{
+	const char *name;
+	uint16_t before[5], after[5];
+	uint8_t stall, link_loss;
+} scenario;
+
+static const scenario scenarios[] =
+{
+	{ "frente-meio",  { 1540, 1540, 1164, 1916, 1522 }, { 1540, 1728, 1164, 1916, 1522 }, 0, 0 },
+	{ "frente-total", { 1540, 1540, 1164, 1916, 1522 }, { 1540, 1916, 1164, 1916, 1522 }, 0, 0 },
+	{ "marcha-re",    { 1540, 1728, 1164, 1916, 1522 }, { 1540, 1352, 1164, 1916, 1522 }, 0, 0 },
+	{ "giro",         { 1540, 1540, 1164, 1916, 1522 }, { 1728, 1540, 1164, 1916, 1522 }, 0, 0 },
+	{ "curva",        { 1540, 1540, 1164, 1916, 1522 }, { 1634, 1728, 1164, 1916, 1522 }, 0, 0 },
+	{ "arma-bateria", { 1540, 1540, 1164, 1916, 1522 }, { 1540, 1728, 1164, 1916, 1916 }, 0, 0 },
+	{ "travado",      { 1540, 1728, 1164, 1916, 1522 }, { 1540, 1728, 1164, 1916, 1522 }, 1, 0 },
+	{ "sem-sinal",    { 1540, 1728, 1164, 1916, 1916 }, { 0 }, 0, 1 },
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenario))
+
+typedef struct
+{
+	double v, w;                // m/s e rad/s do robô
+	double wl, wr;              // rad/s dos motores
+	double weapon;              // rad/s da arma
+	double enc_l, enc_r;        // fração da próxima borda
+	double vbat, vbat_min;
+	uint8_t stalled;            // rodas presas
+} plant_state;
+
+static double sign_soft(double x, double eps)
+{
+	return x / (fabs(x) + eps);
+}
+
+static void plant_step(plant_state *p, double dt)
+{
+	double dl = hal_host_output.motor_left / MOTOR_PWM_TOP;
+	double dr = hal_host_output.motor_right / MOTOR_PWM_TOP;
+	double dw = hal_host_output.esc / 244.0;
+
+	// O motor direito é espelhado: potência positiva leva o robô para trás (ver o
+	// mixer em control.c)
+	p->wl = GEAR_RATIO * (p->v - p->w * ROBOT_TRACK / 2) / WHEEL_RADIUS;
+	p->wr = -GEAR_RATIO * (p->v + p->w * ROBOT_TRACK / 2) / WHEEL_RADIUS;
+
+	// Tensão da bateria: i_k = (d_k V - e_k) / R_k e V = Voc - Rb sum(d_k i_k)
+	double el = MOTOR_KE * p->wl, er = MOTOR_KE * p->wr, ew = WEAPON_KE * p->weapon;
+	double g = dl*dl/MOTOR_R + dr*dr/MOTOR_R + dw*dw/WEAPON_R;
+	double e = dl*el/MOTOR_R + dr*er/MOTOR_R + dw*ew/WEAPON_R;
+	p->vbat = (BATTERY_VOC + BATTERY_R * e) / (1 + BATTERY_R * g);
+	if (p->vbat < p->vbat_min) p->vbat_min = p->vbat;
+
+	double il = (dl * p->vbat - el) / MOTOR_R;
+	double ir = (dr * p->vbat - er) / MOTOR_R;
+	double iw = (dw * p->vbat - ew) / WEAPON_R;
+
+	// Forças nas rodas, com a inércia dos rotores somada à do robô
+	double fl = GEAR_RATIO * MOTOR_KE * il / WHEEL_RADIUS;
+	double fr = -GEAR_RATIO * MOTOR_KE * ir / WHEEL_RADIUS;
+	double jr = MOTOR_J * GEAR_RATIO * GEAR_RATIO / (WHEEL_RADIUS * WHEEL_RADIUS);
+	double mass = ROBOT_MASS + 2 * jr;
+	double inertia = ROBOT_INERTIA + 2 * jr * ROBOT_TRACK * ROBOT_TRACK / 4;
+
+	p->v += (fl + fr - ROLLING_FORCE * sign_soft(p->v, 0.01)) / mass * dt;
+	p->w += ((fr - fl) * ROBOT_TRACK / 2 - SCRUB_TORQUE * sign_soft(p->w, 0.05)) / inertia * dt;
+	p->weapon += WEAPON_KE * iw / WEAPON_J * dt;
+	if (p->stalled) p->v = p->w = 0;
+
+	// Sem a quadratura o encoder só conta bordas, nos dois sentidos
+	p->enc_l += fabs(p->wl) * dt * ENC_EDGES_PER_REV / (2*M_PI);
+	p->enc_r += fabs(p->wr) * dt * ENC_EDGES_PER_REV / (2*M_PI);
+	for (; p->enc_l >= 1; p->enc_l -= 1) { cli(); INT0_vect(); sei(); }
+	for (; p->enc_r >= 1; p->enc_r -= 1) { cli(); INT1_vect(); sei(); }
+}
+
+// Gerador dos pulsos do receptor: t é o tempo desde o começo do frame
+typedef struct
+{
+	uint32_t frame_us, frame_len;
+	uint16_t rise[5], fall[5];
+	uint32_t seed;
+} recv_state;
+
+// widths 0 é um frame sem nenhum pulso (receptor fora do ar)
+static void recv_frame(recv_state *r, const uint16_t *widths)
+{
+	r->seed = r->seed * 1103515245 + 12345;
+	r->frame_len = RECV_FRAME_US + (r->seed >> 16) % (2*RECV_JITTER_US + 1) - RECV_JITTER_US;
+	if (!widths)
+	{
+		memset(r->rise, 0xFF, sizeof(r->rise));
+		memset(r->fall, 0xFF, sizeof(r->fall));
+		return;
+	}
+	uint16_t t = 0;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		r->rise[i] = t;
+		r->fall[i] = t + widths[i];
+		t = r->fall[i] + RECV_GAP_US;
+	}
+	r->rise[4] = RECV_ESC_START_US;
+	r->fall[4] = RECV_ESC_START_US + widths[4];
+}
+
+static void recv_step(recv_state *r, const uint16_t *widths)
+{
+	if (r->frame_us == r->frame_len)
+	{
+		r->frame_us = 0;
+		recv_frame(r, widths);
+	}
+
+	uint32_t t = r->frame_us++;
+	for (uint8_t i = 0; i < 4; i++)
+		if (t == r->rise[i] || t == r->fall[i])
+		{
+			PINC = t == r->rise[i] ? PINC | _BV(i) : PINC & ~_BV(i);
+			cli(); PCINT1_vect(); sei();
+		}
+	if (t == r->rise[4] || t == r->fall[4])
+	{
+		PIND = t == r->rise[4] ? PIND | _BV(7) : PIND & ~_BV(7);
+		cli(); PCINT2_vect(); sei();
+	}
+}
+
+typedef struct
+{
+	double rise_ms, overshoot, settle_ms, ss_error;
+} step_metrics;
+
+// y em unidades de enc_left() a cada SIM_SAMPLE_US, target é o alvo depois do degrau
+static step_metrics measure(const double *y, double target)
+{
+	step_metrics m = { NAN, NAN, NAN, NAN };
+	int step = SIM_STEP_TIME * 1000000 / SIM_SAMPLE_US;
+	int before = 100000 / SIM_SAMPLE_US, last = 250000 / SIM_SAMPLE_US;
+
+	double y0 = 0, yss = 0;
+	for (int i = step - before; i < step; i++) y0 += y[i];
+	y0 /= before;
+	for (int i = SIM_SAMPLES - last; i < SIM_SAMPLES; i++) yss += y[i];
+	yss /= last;
+
+	if (target != 0) m.ss_error = 100 * (yss - target) / fabs(target);
+
+	double delta = target - y0;
+	if (fabs(delta) < 1) return m;
+
+	int t10 = -1, t90 = -1, settle = step;
+	double peak = 0;
+	for (int i = step; i < SIM_SAMPLES; i++)
+	{
+		double f = (y[i] - y0) / delta;
+		if (t10 < 0 && f >= 0.1) t10 = i;
+		if (t90 < 0 && f >= 0.9) t90 = i;
+		if (f - 1 > peak) peak = f - 1;
+		if (fabs(y[i] - target) > 0.05 * fabs(delta)) settle = i + 1;
+	}
+
+	if (t10 >= 0 && t90 >= 0) m.rise_ms = (t90 - t10) * SIM_SAMPLE_US / 1000.0;
+	m.overshoot = 100 * peak;
+	if (settle < SIM_SAMPLES) m.settle_ms = (settle - step) * SIM_SAMPLE_US / 1000.0;
+	return m;
+}
+
+static void print_metrics(const char *name, const char *side, double target, step_metrics m, double vbat)
+{
+	printf("%-13s %-5s %7.0f", name, side, target);
+	if (isnan(m.rise_ms)) printf("  %9s", "-"); else printf("  %9.1f", m.rise_ms);
+	if (isnan(m.overshoot)) printf("  %11s", "-"); else printf("  %10.1f%%", m.overshoot);
+	if (isnan(m.settle_ms)) printf("  %10s", "-"); else printf("  %10.1f", m.settle_ms);
+	if (isnan(m.ss_error)) printf("  %8s", "-"); else printf("  %7.1f%%", m.ss_error);
+	printf("  %6.2f\n", vbat);
+}
+
+// Cenário para o traço em CSV, ou 0 para as medidas
+static const char *trace = 0;
+// Lei de controle dos motores, e se ela usa o feedforward
+static uint8_t pid_mode = PID_MODE_INCREMENTAL, feedforward = 0;
+
+// A mesma sequência do main(), com os ganhos e os tamanhos dos filtros dados
+// (0 mantém o da configuração padrão)
+static void sim_init(const uint16_t *gains, uint8_t recv_samples, uint8_t enc_frames)
+{
+	hal_host_reset();
+	serial_init();
+	config_init();
+	get_config()->left_kp = get_config()->right_kp = gains[0];
+	get_config()->left_ki = get_config()->right_ki = gains[1];
+	get_config()->left_kd = get_config()->right_kd = gains[2];
+	if (recv_samples) get_config()->recv_samples = recv_samples;
+	if (enc_frames) get_config()->enc_frames = enc_frames;
+	get_config()->pid_mode = pid_mode;
+	get_config()->feedforward = feedforward;
+	clock_init();
+	input_init();
+	control_init();
+	telemetry_init();
+	flags = 0;
+	sched_init();
+	load_init();
+	sei();
+}
+
+// Um passo de SIM_STEP_US de tudo: tarefas liberadas, timers, receptor e robô
+static void sim_step(plant_state *p, recv_state *r, const uint16_t *widths)
+{
+	while (sched_run(tasks));
+	hal_host_run(2 * SIM_STEP_US);
+	recv_step(r, widths);
+	plant_step(p, SIM_STEP_US * 1e-6);
+}
+
+static void run_scenario(const scenario *s, const uint16_t *gains)
+{
+	static double yl[SIM_SAMPLES], yr[SIM_SAMPLES];
+	plant_state p = { 0, 0, 0, 0, 0, 0, 0, BATTERY_VOC, BATTERY_VOC, 0 };
+	recv_state r = { 0, 0, { 0 }, { 0 }, 1 };
+
+	sim_init(gains, 0, 0);
+	recv_frame(&r, s->before);
+	for (uint32_t t = 0; t < SIM_END_TIME * 1000000; t += SIM_STEP_US)
+	{
+		const uint16_t *widths = t < SIM_STEP_TIME * 1000000 ? s->before : s->link_loss ? 0 : s->after;
+		// A menor tensão só conta depois do degrau
+		if (t == SIM_STEP_TIME * 1000000) p.vbat_min = BATTERY_VOC;
+		p.stalled = s->stall && t < SIM_STEP_TIME * 1000000;
+
+		sim_step(&p, &r, widths);
+
+		if (t % SIM_SAMPLE_US == 0)
+		{
+			yl[t / SIM_SAMPLE_US] = SPEED_UNITS(p.wl);
+			yr[t / SIM_SAMPLE_US] = SPEED_UNITS(p.wr);
+			if (trace) printf("%u,%d,%d,%.1f,%.1f,%d,%d,%.2f\n", t / 1000, target_l >> 16, target_r >> 16,
+				yl[t / SIM_SAMPLE_US], yr[t / SIM_SAMPLE_US], hal_host_output.motor_left, hal_host_output.motor_right, p.vbat);
+		}
+	}
+	if (trace) return;
+
+	print_metrics(s->name, "esq", target_l >> 16, measure(yl, target_l >> 16), p.vbat_min);
+	print_metrics(s->name, "dir", target_r >> 16, measure(yr, target_r >> 16), p.vbat_min);
+}
+
+// Latência do stick à saída: da descida do primeiro pulso com a largura nova até a
+// primeira mudança da saída do canal (o OCR do motor esquerdo, ou o pulso do ESC).
+// Os degraus alternam entre o neutro e o máximo, em fases aleatórias em relação
+// ao frame do receptor. Na volta ao neutro a saída dos motores tem que ir a zero
+// com o alvo já em zero, para não contar uma passagem do PID pelo zero
+#define LATENCY_STEPS 16
+#define LATENCY_WARMUP_US 600000
+#define LATENCY_INTERVAL_US 300000
+#define LATENCY_STICK_MAX 1916
+
+static const uint8_t latency_samples[] = { 3, 5, 9 };
+static const uint8_t latency_frames[] = { 4, 8, 16 };
+static const uint8_t latency_channels[] = { 0, 1, 4 };
+static const uint16_t latency_neutral[5] = { 1540, 1540, 1164, 1916, 1522 };
+
+static int16_t latency_output(uint8_t ch)
+{
+	return ch == 4 ? hal_host_output.esc : hal_host_output.motor_left;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run_latency(const uint16_t *gains, uint8_t recv_samples, uint8_t enc_frames, uint8_t ch)
+{
+	plant_state p = { 0, 0, 0, 0, 0, 0, 0, BATTERY_VOC, BATTERY_VOC, 0 };
+	recv_state r = { 0, 0, { 0 }, { 0 }, 1 };
+	uint16_t stick[5];
+	uint32_t latency[LATENCY_STEPS];
+	uint8_t count = 0, waiting = 0;
+	uint32_t seed = 1, next_step = LATENCY_WARMUP_US, edge = 0;
+	int16_t before = 0;
+
+	memcpy(stick, latency_neutral, sizeof(stick));
+	sim_init(gains, recv_samples, enc_frames);
+	recv_frame(&r, stick);
+
+	for (uint32_t t = 0; count < LATENCY_STEPS && t < LATENCY_WARMUP_US + 2 * LATENCY_STEPS * LATENCY_INTERVAL_US; t += SIM_STEP_US)
+	{
+		if (t == next_step)
+		{
+			stick[ch] = stick[ch] == latency_neutral[ch] ? LATENCY_STICK_MAX : latency_neutral[ch];
+			before = latency_output(ch);
+			waiting = 1;
+			seed = seed * 1103515245 + 12345;
+			next_step += LATENCY_INTERVAL_US + (seed >> 16) % RECV_FRAME_US;
+		}
+
+		sim_step(&p, &r, stick);
+
+		// O frame que começou agora já tem a largura nova
+		if (waiting == 1 && r.frame_us == 1)
+		{
+			edge = t + r.fall[ch];
+			waiting = 2;
+		}
+		else if (waiting == 2 && t >= edge)
+		{
+			int16_t out = latency_output(ch);
+			if (ch != 4 && stick[ch] == latency_neutral[ch] ? out == 0 && target_l == 0 : out != before)
+			{
+				latency[count++] = t + SIM_STEP_US - edge;
+				waiting = 0;
+			}
+		}
+	}
+
+	printf("%8u %6u %5u  %-10s", recv_samples, enc_frames, ch, ch == 4 ? "esc" : "motor_esq");
+	if (count == 0)
+	{
+		printf("  sem mudança na saída\n");
+		return;
+	}
+
+	qsort(latency, count, sizeof(uint32_t), compare_u32);
+	double sum = 0;
+	for (uint8_t i = 0; i < count; i++) sum += latency[i];
+	printf("  %7.1f  %7.1f  %7.1f  %7.1f  %7.1f  %u\n", latency[0] / 1000.0, latency[count / 2] / 1000.0,
+		latency[count * 9 / 10] / 1000.0, latency[count - 1] / 1000.0, sum / count / 1000.0, count);
+}
+
+// Calibração do feedforward: PWM fixo nos dois motores, sem o firmware, e a
+// velocidade em regime de cada um; a tabela é a interpolação inversa disso
+#define CAL_PWM_STEP 2
+#define CAL_LEVELS (250 / CAL_PWM_STEP + 1)
+#define CAL_TIME_US 1000000
+#define CAL_DT_US 10
+
+static uint8_t cal_lookup(const double *speed, double target)
+{
+	if (target <= speed[0]) return 0;
+	for (uint8_t i = 1; i < CAL_LEVELS; i++)
+		if (speed[i] >= target)
+			return lround(CAL_PWM_STEP * (i - 1 + (target - speed[i-1]) / (speed[i] - speed[i-1])));
+	return 250;
+}
+
+static void run_calibration()
+{
+	double speed_l[CAL_LEVELS], speed_r[CAL_LEVELS];
+	hal_host_reset();
+	input_init();
+
+	for (uint8_t i = 0; i < CAL_LEVELS; i++)
+	{
+		plant_state p = { 0, 0, 0, 0, 0, 0, 0, BATTERY_VOC, BATTERY_VOC, 0 };
+		motor_set_power_left(i * CAL_PWM_STEP);
+		motor_set_power_right(-i * CAL_PWM_STEP);
+		for (uint32_t t = 0; t < CAL_TIME_US; t += CAL_DT_US) plant_step(&p, CAL_DT_US * 1e-6);
+		speed_l[i] = SPEED_UNITS(p.wl);
+		speed_r[i] = -SPEED_UNITS(p.wr);
+	}
+
+	printf("%3s  %8s %8s\n", "pwm", "veloc_e", "veloc_d");
+	for (uint8_t i = 0; i < CAL_LEVELS; i += 8 / CAL_PWM_STEP)
+		printf("%3u  %8.1f %8.1f\n", i * CAL_PWM_STEP, speed_l[i], speed_r[i]);
+
+	printf("\nconst uint8_t PROGMEM ff_table[2][FF_POINTS] =\n{\n");
+	for (uint8_t side = 0; side < 2; side++)
+	{
+		printf("\t{");
+		for (uint8_t j = 0; j < FF_POINTS; j++)
+			printf(" %u%s", cal_lookup(side ? speed_r : speed_l, j << FF_STEP_SHIFT), j < FF_POINTS - 1 ? "," : " ");
+		printf("},\n");
+	}
+	printf("};\n");
+}
+
+int main(int argc, char **argv)
+{
+	double kp, ki, kd;
+	int arg = 1, latency = 0;
+	if (argc > 2 && !strcmp(argv[1], "-m"))
+	{
+		pid_mode = atoi(argv[2]);
+		arg = 3;
+	}
+	if (argc > arg && !strcmp(argv[arg], "-f"))
+	{
+		feedforward = 1;
+		arg++;
+	}
+	if (argc > arg + 1 && !strcmp(argv[arg], "-t"))
+	{
+		trace = argv[arg+1];
+		arg += 2;
+	}
+	else if (argc > arg && !strcmp(argv[arg], "-l"))
+	{
+		latency = 1;
+		arg++;
+	}
+	else if (argc == arg + 1 && !strcmp(argv[arg], "-c"))
+	{
+		run_calibration();
+		return 0;
+	}
+	if (argc == arg + 3)
+	{
+		kp = atof(argv[arg]);
+		ki = atof(argv[arg+1]);
+		kd = atof(argv[arg+2]);
+	}
+	else if (argc == arg)
+	{
+		const uint16_t *g = sim_gains[pid_mode != PID_MODE_INCREMENTAL];
+		kp = g[0] / 256.0;
+		ki = g[1] / 256.0;
+		kd = g[2] / 256.0;
+	}
+	else
+	{
+		fprintf(stderr, "uso: %s [-m pid_mode] [-f] [-t cenário | -l | -c] [kp ki kd]\n", argv[0]);
+		return 1;
+	}
+
+	// Os ganhos são 8.8 na configuração
+	uint16_t gains[3] = { lround(kp * 256), lround(ki * 256), lround(kd * 256) };
+
+	if (trace)
+	{
+		for (uint8_t i = 0; i < NUM_SCENARIOS; i++)
+			if (!strcmp(scenarios[i].name, trace))
+			{
+				printf("t_ms,alvo_e,alvo_d,veloc_e,veloc_d,saida_e,saida_d,vbat\n");
+				run_scenario(&scenarios[i], gains);
+				return 0;
+			}
+		fprintf(stderr, "cenário desconhecido: %s\n", trace);
+		return 1;
+	}
+
+	if (latency)
+	{
+		// As larguras contam bytes: as palavras com acento levam um a mais
+		printf("latência da borda do pulso do receptor até a saída, ms (%u degraus cada)\n", LATENCY_STEPS);
+		printf("%8s %6s %5s  %-11s  %8s  %7s  %7s  %8s  %8s  %s\n",
+			"amostras", "frames", "canal", "saída", "mín", "mediana", "p90", "máx", "média", "n");
+		for (uint8_t i = 0; i < sizeof(latency_samples); i++)
+			for (uint8_t j = 0; j < sizeof(latency_frames); j++)
+				for (uint8_t k = 0; k < sizeof(latency_channels); k++)
+				{
+					fflush(stdout);
+					pid_t pid = fork();
+					if (pid == 0)
+					{
+						run_latency(gains, latency_samples[i], latency_frames[j], latency_channels[k]);
+						fflush(stdout);
+						_exit(0);
+					}
+					waitpid(pid, 0, 0);
+				}
+		return 0;
+	}
+
+	printf("pid_mode %u%s, kp %.3f ki %.3f kd %.3f (8.8: 0x%04X 0x%04X 0x%04X)\n", pid_mode, feedforward ? " com feedforward" : "", kp, ki, kd, gains[0], gains[1], gains[2]);
+	printf("%-14s %-5s %7s  %9s  %11s  %10s  %8s  %6s\n",
+		"cenário", "lado", "alvo", "subida ms", "sobressinal", "acomod. ms", "erro rp", "vbat");
+
+	// Cada cenário roda num processo novo, com o estado dos módulos zerado
+	for (uint8_t i = 0; i < NUM_SCENARIOS; i++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			run_scenario(&scenarios[i], gains);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(pid, 0, 0);
+	}
+
+	return 0;
+}
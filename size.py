@@ -1,5 +1,9 @@
 #!/usr/bin/python
+# -*- coding: utf-8 -*-
 import subprocess
+import sys
+import glob
+import re
 
 string = subprocess.check_output(['avr-size', 'out.elf'])
 tbl = map(lambda ls: map(lambda s: s.strip(), filter(bool, ls.split('\t'))),
@@ -15,3 +19,93 @@ total_data = int(val['data']) + int(val['bss'])
 print "Total bytes written to flash:", total_program
 print "Total bytes used on SRAM:", total_data
 
+# Arena (ver arena.c): as janelas e os frames são alocados na inicialização,
+# com o tamanho que a configuração pede. Os tamanhos abaixo seguem
+# MEDIAN_BYTES() (default.h), enc_frames (input.c) e TELEMETRY_BUFFER_LENGTH
+# (telemetry.c)
+SRAM_SIZE = 2048
+STACK_RESERVE = 256
+TELEMETRY_BUFFER = 96
+
+def arena_size(recv_samples, enc_frames, framed=False, telemetry=True):
+	median = 0 if framed else 5 * 4 * recv_samples
+	return median + 2 * 2 * enc_frames + (TELEMETRY_BUFFER if telemetry else 0)
+
+configs = [
+	("default (5 samples, 8 frames)", arena_size(5, 8)),
+	("3-sample filters, 8 frames", arena_size(3, 8)),
+	("PPM, 8 frames", arena_size(0, 8, framed=True)),
+	("SBUS/iBUS, 8 frames", arena_size(0, 8, framed=True, telemetry=False)),
+	("worst case (31 samples, 32 frames)", arena_size(31, 32)),
+]
+
+print "Arena usage per configuration (SRAM left for the stack):"
+for name, arena in configs:
+	free = SRAM_SIZE - total_data - arena
+	print "  %-36s %4d bytes, %4d free%s" % (name, arena, free,
+		"" if free >= STACK_RESERVE else " (below the stack reserve!)")
+
+# Relatório por módulo e por símbolo (make size-report): os tamanhos vêm do
+# out.elf, e o módulo de cada símbolo vem dos objetos (com LTO o out.elf não
+# guarda mais o arquivo de origem). Os símbolos que o LTO renomeou ou criou
+# ficam em "(outros)"
+if len(sys.argv) < 2 or sys.argv[1] != "--report":
+	sys.exit(0)
+
+budgets = { "flash": 32768, "sram": SRAM_SIZE - STACK_RESERVE, "eeprom": 1024 }
+for arg in sys.argv[2:]:
+	name, _, value = arg.partition('=')
+	if name.startswith("--") and name[2:] in budgets:
+		budgets[name[2:]] = int(value)
+
+def region(addr, kind):
+	if addr >= 0x810000: return "eeprom"
+	if addr >= 0x800000: return "sram"
+	return "flash"
+
+symbol_module = {}
+for obj in glob.glob('*.o'):
+	module = obj[:-2]
+	for line in subprocess.check_output(['avr-nm', '--defined-only', obj]).split('\n'):
+		fields = line.split()
+		if len(fields) >= 2:
+			symbol_module[fields[-1]] = module
+
+symbols = []
+for line in subprocess.check_output(['avr-nm', '--print-size', '--size-sort', 'out.elf']).split('\n'):
+	fields = line.split()
+	if len(fields) != 4: continue
+	addr, size, kind, name = int(fields[0], 16), int(fields[1], 16), fields[2], fields[3]
+	module = symbol_module.get(re.sub(r'\.(lto_priv|constprop|isra|part)\.\d+$', '', name), "(outros)")
+	symbols.append((region(addr, kind), size, name, module))
+	# As variáveis inicializadas também ocupam a flash, com os valores iniciais
+	if kind in "dD" and region(addr, kind) == "sram": symbols.append(("flash", size, name, module))
+
+modules = {}
+for reg, size, name, module in symbols:
+	modules.setdefault(module, { "flash": 0, "sram": 0, "eeprom": 0 })[reg] += size
+
+print
+print "%-16s %8s %8s %8s" % ("module", "flash", "sram", "eeprom")
+for module in sorted(modules, key=lambda m: -modules[m]["flash"] - modules[m]["sram"]):
+	m = modules[module]
+	print "%-16s %8d %8d %8d" % (module, m["flash"], m["sram"], m["eeprom"])
+
+for reg in ["flash", "sram", "eeprom"]:
+	print
+	print "Largest %s symbols:" % reg
+	for _, size, name, module in sorted(filter(lambda s: s[0] == reg, symbols), key=lambda s: -s[1])[:15]:
+		print "  %6d  %-32s %s" % (size, name, module)
+
+# Verificação do orçamento: a SRAM conta a arena do pior caso
+eeprom = sum(map(lambda s: s[1], filter(lambda s: s[0] == "eeprom", symbols)))
+usage = { "flash": total_program, "sram": total_data + configs[-1][1], "eeprom": eeprom }
+
+print
+failed = False
+for reg in ["flash", "sram", "eeprom"]:
+	ok = usage[reg] <= budgets[reg]
+	failed = failed or not ok
+	print "%-6s %6d of %6d bytes budget %s" % (reg, usage[reg], budgets[reg], "ok" if ok else "EXCEEDED")
+
+sys.exit(1 if failed else 0)
@@ -0,0 +1,93 @@
+//
+// telemetry.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem as consultas de telemetria, que podem ser feitas
+// pela serial com o robô rodando (fora do modo de configuração).
+// O computador manda um byte com o número da consulta, e o robô
+// responde com o tamanho, o número da consulta e os dados, no
+// mesmo formato das respostas do modo de configuração
+//
+// Nada aqui espera a serial: telemetry_poll() é uma tarefa de baixa
+// prioridade (ver sched.c), e só escreve um byte se o UDR0 estiver livre.
+// Como o loop acorda pelo menos a cada overflow do Timer1 (1,024 ms)
+// e um byte a 19200 baud leva 0,52 ms, a resposta sai a ~1 byte/ms
+// sem atrasar o controle. Nos modos de receptor serial a USART é do
+// receptor, e não há telemetria
+//
+
+#include "default.h"
+
+#define TELEMETRY_RECV_STATS 0x01
+#define TELEMETRY_SCHED_STATS 0x02
+#define TELEMETRY_LOAD 0x03
+#define TELEMETRY_MEMORY 0x04
+
+#define TELEMETRY_BUFFER_LENGTH 96
+
+// O buffer fica na arena, alocado depois das entradas
+static uint8_t *tx_buffer = 0;
+static uint8_t tx_pos = 0, tx_size = 0;
+
+// Monta a resposta da consulta no buffer; retorna o tamanho dos dados, ou 0 se a
+// consulta não existe
+static uint8_t telemetry_fill(uint8_t query, uint8_t *data)
+{
+	switch (query)
+	{
+		case TELEMETRY_RECV_STATS:
+			memcpy(data, recv_get_stats(), 5*sizeof(recv_stats_struct));
+			return 5*sizeof(recv_stats_struct);
+		case TELEMETRY_SCHED_STATS:
+			sched_get_stats((sched_stats_struct*)data);
+			return SCHED_NUM_TASKS*sizeof(sched_stats_struct);
+		case TELEMETRY_LOAD:
+			memcpy(data, load_get_stats(), sizeof(load_stats_struct));
+			return sizeof(load_stats_struct);
+		case TELEMETRY_MEMORY:
+			memcpy(data, memory_get_stats(), sizeof(memory_stats_struct));
+			return sizeof(memory_stats_struct);
+		default: return 0;
+	}
+}
+
+void telemetry_init()
+{
+	if (RECV_MODE_SERIAL(get_config()->recv_mode)) return;
+	tx_buffer = arena_alloc(TELEMETRY_BUFFER_LENGTH);
+}
+
+// Há um byte para enviar e o UDR0 está livre, ou há uma consulta chegando
+uint8_t telemetry_ready()
+{
+	if (!tx_buffer) return 0;
+	if (tx_pos < tx_size) return (UCSR0A & _BV(UDRE0)) != 0;
+	return rx_byte_available();
+}
+
+void telemetry_poll()
+{
+	if (!tx_buffer) return;
+
+	// Continua a resposta em andamento
+	if (tx_pos < tx_size)
+	{
+		if (UCSR0A & _BV(UDRE0)) UDR0 = tx_buffer[tx_pos++];
+		return;
+	}
+
+	if (!rx_byte_available()) return;
+	uint8_t query = UDR0;
+
+	// Consultas desconhecidas (inclusive o handshake do modo de configuração) são ignoradas
+	uint8_t size = telemetry_fill(query, tx_buffer + 2);
+	if (size == 0) return;
+
+	tx_buffer[0] = size + 1;
+	tx_buffer[1] = query;
+	tx_pos = 0;
+	tx_size = size + 2;
+}
@@ -0,0 +1,126 @@
+//
+// capture.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes da captura dos pulsos PWM (PCINT1_vect e PCINT2_vect em input.c):
+// pulsos de largura conhecida, com as bordas em qualquer fase do Timer1 e
+// cada interrupt atrasado por uma latência aleatória de até latency ticks,
+// com os interrupts desligados (como se outro interrupt estivesse rodando,
+// com o overflow do Timer1 pendente). O erro da largura em last_times tem
+// que ficar dentro da diferença das latências das duas bordas
+//
+// O "antes" é o carimbo antigo, de 4 us (TCNT0 e o contador de overflows),
+// calculado sobre as mesmas bordas: o código antigo não existe mais, então
+// só a quantização dele entra na conta. host/test/run capture mostra o erro
+// máximo e o desvio padrão do erro (o jitter) dos dois
+//
+
+#include "test.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define CAPTURE_PULSES 2000
+// O carimbo antigo andava a cada 8 ticks do Timer1
+#define CAPTURE_OLD_TICKS 8
+
+extern volatile uint16_t last_times[5][2];
+
+typedef struct
+{
+	int32_t max;
+	double sum, sum2;
+} capture_error;
+
+// Tempo desde o começo, em ticks do Timer1, que o teste conta sozinho
+static uint32_t capture_now;
+
+static void capture_run(uint32_t ticks)
+{
+	hal_host_run(ticks);
+	capture_now += ticks;
+}
+
+static void capture_add(capture_error *e, int32_t err)
+{
+	if (abs(err) > e->max) e->max = abs(err);
+	e->sum += err;
+	e->sum2 += (double)err * err;
+}
+
+static double capture_jitter_us(const capture_error *e)
+{
+	double mean = e->sum / CAPTURE_PULSES;
+	return sqrt(e->sum2 / CAPTURE_PULSES - mean * mean) / 2;
+}
+
+// Muda o pino do canal e roda o interrupt latency ticks depois, com os interrupts
+// desligados nesse meio tempo; retorna o instante da borda
+static uint32_t capture_edge(uint8_t ch, uint8_t high, uint8_t latency)
+{
+	uint32_t edge = capture_now;
+	if (ch < 4) PINC = high ? PINC | _BV(ch) : PINC & ~_BV(ch);
+	else PIND = high ? PIND | _BV(7) : PIND & ~_BV(7);
+
+	cli();
+	hal_host_run(latency);
+	capture_now += latency;
+	if (ch < 4) PCINT1_vect();
+	else PCINT2_vect();
+	sei();
+	capture_run(0);
+	return edge;
+}
+
+// Os canais 0 a 3 em sequência e o 4, com larguras e fases aleatórias
+static void test_latency(uint8_t latency)
+{
+	capture_error now = { 0, 0, 0 }, old = { 0, 0, 0 };
+	uint8_t exact = 1;
+
+	test_config();
+	test_start();
+	capture_now = 0;
+
+	for (uint16_t p = 0; p < CAPTURE_PULSES; p++)
+	{
+		uint8_t ch = p % 5;
+		uint16_t width = RECV_MIN + rand() % (RECV_MAX - RECV_MIN + 1);
+		uint8_t lat_rise = latency ? rand() % (latency + 1) : 0;
+		uint8_t lat_fall = latency ? rand() % (latency + 1) : 0;
+
+		// Fase aleatória, para as bordas caírem também em volta do overflow
+		capture_run(50 + rand() % (ICR1 + 1));
+		uint32_t rise = capture_edge(ch, 1, lat_rise);
+		capture_run(width - lat_rise);
+		uint32_t fall = capture_edge(ch, 0, lat_fall);
+
+		int32_t err = (uint16_t)(last_times[ch][1] - last_times[ch][0]) - (int32_t)width;
+		capture_add(&now, err);
+		if (abs(err) > latency) exact = 0;
+
+		int32_t old_width = ((fall + lat_fall) / CAPTURE_OLD_TICKS - (rise + lat_rise) / CAPTURE_OLD_TICKS) * CAPTURE_OLD_TICKS;
+		capture_add(&old, old_width - (int32_t)width);
+	}
+
+	if (!exact) test_fail(__FILE__, __LINE__, "erro acima de %u ticks com latência de até %u ticks", latency, latency);
+	test_checks++;
+	// A quantização de 4 us do carimbo antigo soma até 8 ticks ao erro
+	CHECK(now.max < old.max);
+	CHECK(capture_jitter_us(&now) < capture_jitter_us(&old));
+	if (test_verbose)
+		printf("  latência até %4.1f us: erro máximo %4.1f us, jitter %4.2f us (antes: %4.1f us, %4.2f us)\n",
+			latency / 2.0, now.max / 2.0, capture_jitter_us(&now), old.max / 2.0, capture_jitter_us(&old));
+}
+
+void test_capture()
+{
+	srand(2);
+	// Sem latência a largura é exata; 16 ticks (8 us, 128 ciclos) cobrem o maior
+	// interrupt dos encoders (ver enc.S)
+	test_latency(0);
+	test_latency(4);
+	test_latency(16);
+}
@@ -0,0 +1,82 @@
+//
+// clock.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do relógio (clock.c) nas viradas do Timer1: com o overflow
+// pendente (interrupts desligados na hora da virada, por até meio
+// período), clock_now_us() e clock_ticks() têm que continuar contando
+// o tempo exato, e clock_now_us() tem que passar pela virada dos 8
+// bits do r7
+//
+
+#include "test.h"
+#include <stdlib.h>
+
+// Um pouco mais de 256 overflows (262 ms), para o r7 dar a volta
+#define CLOCK_TEST_TICKS (2048UL * 300)
+// Os trechos sem interrupts têm que ser menores que meio período (ver HALF_PERIOD)
+#define CLOCK_MAX_CLI_TICKS 900
+
+static void test_raw()
+{
+	// Sem overflow pendente, a foto é usada como está
+	CHECK_EQ(clock_ticks_raw(100, 3, 0), 100 | (3 << 11));
+	// Overflow pendente com o TCNT1 já reiniciado: ele ainda não foi contado
+	CHECK_EQ(clock_ticks_raw(5, 3, _BV(TOV1)), 5 | (4 << 11));
+	// Flag ligada, mas o TCNT1 foi lido antes da virada
+	CHECK_EQ(clock_ticks_raw(2040, 3, _BV(TOV1)), 2040 | (3 << 11));
+	// A virada dos 16 bits
+	CHECK_EQ(clock_ticks_raw(0, 31, _BV(TOV1)), 0);
+	CHECK_EQ(clock_ticks_raw(2047, 31, 0), 0xFFFF);
+}
+
+void test_clock()
+{
+	test_config();
+	test_raw();
+
+	clock_init();
+	sei();
+	srand(3);
+
+	uint32_t ticks = 0, last_us = 0;
+	uint8_t ok_now = 1, ok_ticks = 1, ok_pending = 0;
+	while (ticks < CLOCK_TEST_TICKS)
+	{
+		// Desliga os interrupts às vezes, de preferência perto da virada
+		uint16_t cli_ticks = 0;
+		if (TCNT1 > ICR1 - 64 && rand() % 2) cli_ticks = 1 + rand() % CLOCK_MAX_CLI_TICKS;
+		else if (rand() % 256 == 0) cli_ticks = 1 + rand() % CLOCK_MAX_CLI_TICKS;
+
+		if (cli_ticks) cli();
+		do
+		{
+			hal_host_run(1);
+			ticks++;
+			if (TIFR1 & _BV(TOV1)) ok_pending = 1;
+
+			uint32_t now = clock_now_us();
+			if (now != ticks >> 1 || now < last_us) ok_now = 0;
+			last_us = now;
+
+			uint8_t sreg = SREG;
+			cli();
+			if (clock_ticks() != (uint16_t)ticks) ok_ticks = 0;
+			SREG = sreg;
+		}
+		while (cli_ticks && --cli_ticks);
+		// Como no hardware, o overflow pendente roda logo depois do sei()
+		sei();
+		hal_host_run(0);
+	}
+
+	if (!ok_pending) test_fail(__FILE__, __LINE__, "nenhum overflow ficou pendente");
+	if (!ok_now) test_fail(__FILE__, __LINE__, "clock_now_us() errado numa virada");
+	if (!ok_ticks) test_fail(__FILE__, __LINE__, "clock_ticks() errado numa virada");
+	test_checks += 3;
+	// O r7 deu a volta
+	CHECK(clock_now_us() > 256 * 1024UL);
+}
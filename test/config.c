@@ -0,0 +1,119 @@
+//
+// config.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes da leitura da configuração (config.c): as três cópias na EEPROM
+// com o checksum de cada uma, a votação, a versão do formato e a faixa dos
+// tamanhos das janelas e do período do controle
+//
+
+#include "test.h"
+
+extern config_struct eeprom_configs[3];
+extern uint8_t eeprom_check[3], eeprom_version;
+extern const config_struct default_config;
+
+#define CONFIG_VERSION 2
+
+static uint8_t config_checksum(const config_struct *cfg)
+{
+	uint8_t res = 0;
+	for (uint8_t i = 0; i < sizeof(config_struct); i++)
+		res ^= ((const uint8_t*)cfg)[i];
+	return res;
+}
+
+// Grava a cópia j com o checksum de good (que pode não ser o dela)
+static void config_write(uint8_t j, const config_struct *cfg, const config_struct *good)
+{
+	uint8_t check = config_checksum(good);
+	update_eeprom(&eeprom_configs[j], cfg, sizeof(config_struct));
+	update_eeprom(&eeprom_check[j], &check, 1);
+}
+
+static void config_write_version(uint8_t version)
+{
+	update_eeprom(&eeprom_version, &version, 1);
+}
+
+// Tamanhos e períodos fora da faixa gravados com checksum certo voltam ao padrão
+static void config_range(uint8_t enc_frames, uint8_t recv_samples, uint16_t control_period)
+{
+	config_struct cfg;
+	memcpy(&cfg, &default_config, sizeof(config_struct));
+	cfg.enc_frames = enc_frames;
+	cfg.recv_samples = recv_samples;
+	cfg.control_period = control_period;
+	for (uint8_t j = 0; j < 3; j++) config_write(j, &cfg, &cfg);
+	config_write_version(CONFIG_VERSION);
+	test_config();
+}
+
+static void test_config_ranges()
+{
+	config_range(0, 4, 500);
+	CHECK_EQ(get_config()->enc_frames, default_config.enc_frames);
+	CHECK_EQ(get_config()->recv_samples, default_config.recv_samples);
+	CHECK_EQ(get_config()->control_period, default_config.control_period);
+
+	config_range(33, 33, 10001);
+	CHECK_EQ(get_config()->enc_frames, default_config.enc_frames);
+	CHECK_EQ(get_config()->recv_samples, default_config.recv_samples);
+	CHECK_EQ(get_config()->control_period, default_config.control_period);
+
+	// Os extremos valem
+	config_range(1, 1, 1000);
+	CHECK_EQ(get_config()->enc_frames, 1);
+	CHECK_EQ(get_config()->recv_samples, 1);
+	CHECK_EQ(get_config()->control_period, 1000);
+	config_range(32, 31, 10000);
+	CHECK_EQ(get_config()->enc_frames, 32);
+	CHECK_EQ(get_config()->recv_samples, 31);
+	CHECK_EQ(get_config()->control_period, 10000);
+}
+
+void test_config_eeprom()
+{
+	config_struct cfg, bad;
+	memcpy(&cfg, &default_config, sizeof(config_struct));
+	cfg.left_kp = 0x0280;
+	cfg.pid_kaw = 0x0200;
+	cfg.feedforward = 1;
+
+	// Três cópias boas
+	for (uint8_t j = 0; j < 3; j++) config_write(j, &cfg, &cfg);
+	config_write_version(CONFIG_VERSION);
+	test_config();
+	CHECK_EQ(get_config()->left_kp, 0x0280);
+	CHECK_EQ(get_config()->pid_kaw, 0x0200);
+	CHECK_EQ(get_config()->feedforward, 1);
+
+	// Duas cópias com um byte do fim da struct corrompido: o checksum tem que
+	// pegar, e elas viram a configuração padrão, que ganha a votação
+	memcpy(&bad, &cfg, sizeof(config_struct));
+	bad.pid_kaw = 0x0700;
+	config_write(0, &bad, &cfg);
+	config_write(1, &bad, &cfg);
+	test_config();
+	CHECK_EQ(get_config()->pid_kaw, default_config.pid_kaw);
+
+	// Uma cópia corrompida perde a votação para as outras duas
+	config_write(1, &cfg, &cfg);
+	test_config();
+	CHECK_EQ(get_config()->pid_kaw, 0x0200);
+
+	// Gravada por outra versão do firmware (ou nunca gravada): a padrão
+	config_write(0, &cfg, &cfg);
+	config_write_version(CONFIG_VERSION - 1);
+	test_config();
+	CHECK_EQ(get_config()->left_kp, default_config.left_kp);
+	CHECK_EQ(get_config()->feedforward, 0);
+	config_write_version(0xFF);
+	test_config();
+	CHECK_EQ(get_config()->left_kp, default_config.left_kp);
+
+	test_config_ranges();
+}
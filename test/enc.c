@@ -0,0 +1,156 @@
+//
+// enc.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do estimador M/T dos encoders (enc_estimator = 1): trens de
+// bordas sintéticos no INT0, com o período conhecido, comparados com a
+// velocidade real e com a média de janela de enc_left(), em precisão
+// nas velocidades constantes e em atraso num degrau de velocidade
+//
+
+#include "test.h"
+
+// Tempo para as duas estimativas assentarem (enc_frames = 8 dá 65 ms)
+#define ENC_SETTLE_US 300000
+#define ENC_MEASURE_US 200000
+// Erro máximo do M/T, em 1/1000 da velocidade real
+#define ENC_MT_MAX_ERROR 10
+// Faixa considerada assentada no degrau, em 1/1000
+#define ENC_STEP_BAND 20
+
+static uint32_t enc_now_us, enc_next_us;
+
+// Velocidade real, em 16.16 e nas unidades de enc_left(): bordas em 8192 us vezes 11/8
+static int32_t enc_true(uint32_t period_us)
+{
+	return (int32_t)((11264LL << 16) / period_us);
+}
+
+static uint32_t enc_error(int32_t v, int32_t ref)
+{
+	int64_t d = (int64_t)v - ref;
+	return (uint32_t)((d < 0 ? -d : d) * 1000 / ref);
+}
+
+// Avança o tempo mandando uma borda no encoder esquerdo a cada period_us (0 para
+// nenhuma); err_mt e err_avg guardam o maior erro de cada estimador (podem ser 0)
+static void enc_run(uint32_t period_us, uint32_t us, uint32_t *err_mt, uint32_t *err_avg)
+{
+	int32_t ref = period_us ? enc_true(period_us) : 0;
+	while (us--)
+	{
+		if (period_us && enc_now_us >= enc_next_us)
+		{
+			cli(); INT0_vect(); sei();
+			enc_next_us += period_us;
+		}
+		test_run_us(1);
+		enc_now_us++;
+
+		if (err_mt)
+		{
+			uint32_t e = enc_error(enc_speed_left(), ref);
+			if (e > *err_mt) *err_mt = e;
+		}
+		if (err_avg)
+		{
+			uint32_t e = enc_error((int32_t)enc_left() << 16, ref);
+			if (e > *err_avg) *err_avg = e;
+		}
+	}
+}
+
+static void test_accuracy()
+{
+	static const uint32_t periods[] = { 40, 150, 1000, 4000, 30000 };
+
+	enc_next_us = enc_now_us;
+	for (uint8_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+	{
+		uint32_t err_mt = 0, err_avg = 0;
+		enc_run(periods[i], ENC_SETTLE_US, 0, 0);
+		enc_run(periods[i], ENC_MEASURE_US, &err_mt, &err_avg);
+
+		if (err_mt > ENC_MT_MAX_ERROR)
+			test_fail(__FILE__, __LINE__, "M/T com erro de %u/1000 com bordas a cada %u us",
+				err_mt, periods[i]);
+		// Em baixa rotação a janela quantiza em bordas inteiras por tick
+		if (periods[i] >= 1000 && err_mt >= err_avg)
+			test_fail(__FILE__, __LINE__, "M/T (%u/1000) não é melhor que a janela (%u/1000) com %u us",
+				err_mt, err_avg, periods[i]);
+		test_checks += 2;
+	}
+}
+
+// Tempo, depois da troca do período, até a estimativa entrar na faixa em volta do
+// valor final dela (a janela quantiza, então não chega perto do valor real) e não
+// sair mais
+static int32_t enc_trace[ENC_SETTLE_US];
+
+static uint32_t enc_step_latency(int32_t (*speed)())
+{
+	enc_run(1000, ENC_SETTLE_US, 0, 0);
+	for (uint32_t t = 0; t < ENC_SETTLE_US; t++)
+	{
+		enc_run(500, 1, 0, 0);
+		enc_trace[t] = speed();
+	}
+
+	int32_t ref = enc_trace[ENC_SETTLE_US - 1];
+	uint32_t last_out = 0;
+	for (uint32_t t = 0; t < ENC_SETTLE_US; t++)
+		if (enc_error(enc_trace[t], ref) > ENC_STEP_BAND) last_out = t + 1;
+	return last_out;
+}
+
+static int32_t enc_avg_left()
+{
+	return (int32_t)enc_left() << 16;
+}
+
+static void test_step()
+{
+	uint32_t control_us = get_config()->control_period;
+	uint32_t mt = enc_step_latency(enc_speed_left);
+	uint32_t avg = enc_step_latency(enc_avg_left);
+
+	// O M/T mede um tick só; a média precisa de enc_frames ticks
+	CHECK_RANGE(mt, 0, 2 * control_us);
+	CHECK_RANGE(avg, (get_config()->enc_frames - 1) * control_us, (get_config()->enc_frames + 1) * control_us);
+}
+
+static void test_stop()
+{
+	// Sem bordas, a velocidade cai com o limite de uma borda desde a última, e
+	// zera depois de ENC_MT_TIMEOUT_US (100 ms)
+	enc_run(1000, ENC_SETTLE_US, 0, 0);
+	int32_t last = enc_speed_left();
+	uint8_t monotonic = 1;
+	uint32_t zero_us = 0;
+	for (uint32_t t = 0; t < 200000 && !zero_us; t++)
+	{
+		enc_run(0, 1, 0, 0);
+		int32_t v = enc_speed_left();
+		if (v > last) monotonic = 0;
+		if (v == 0) zero_us = t;
+		last = v;
+	}
+
+	CHECK(monotonic);
+	CHECK_RANGE(zero_us, 100000 - 1000, 100000 + get_config()->control_period);
+}
+
+void test_enc()
+{
+	test_config();
+	get_config()->enc_estimator = 1;
+	test_start();
+
+	enc_now_us = enc_next_us = 0;
+	test_accuracy();
+	test_step();
+	test_stop();
+}
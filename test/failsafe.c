@@ -0,0 +1,86 @@
+//
+// failsafe.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do failsafe (control.c): com o robô andando e a arma ligada, o
+// trem de pulsos do receptor é cortado, e os motores e a arma têm que
+// chegar a zero, sem saltos, dentro do orçamento de recv_timeout +
+// (FAILSAFE_RAMP_FRAMES+1) * 8,192 ms (157 ms com o timeout padrão); com
+// a volta dos pulsos, o controle é rearmado
+//
+
+#include "test.h"
+#include <stdlib.h>
+
+#define FRAME_US 20000
+#define FAILSAFE_BUDGET_US(timeout_ms) ((timeout_ms) * 1000UL + 7 * 8192UL)
+
+// Frente com a arma ligada; o canal 2 abaixo do centro não inverte
+static const uint16_t drive[5] = { 1500, 1800, 1000, 1500, 1800 };
+
+static uint16_t output_mag()
+{
+	return abs(hal_host_output.motor_left) + abs(hal_host_output.motor_right) + abs(hal_host_output.esc);
+}
+
+// Corta os pulsos e retorna o tempo, desde o começo do último frame, até as
+// saídas zerarem; ramp_ok indica se elas só diminuíram no caminho
+static uint32_t failsafe_cut(uint8_t *ramp_ok)
+{
+	uint32_t t0 = clock_now_us();
+	test_recv_frame(drive, FRAME_US);
+
+	uint16_t last = output_mag();
+	*ramp_ok = 1;
+	for (uint32_t t = 0; t < 500000; t++)
+	{
+		test_run_us(1);
+		uint16_t mag = output_mag();
+		if (mag > last) *ramp_ok = 0;
+		last = mag;
+		if (mag == 0) return clock_now_us() - t0;
+	}
+	return 0xFFFFFFFF;
+}
+
+static void failsafe_run(uint8_t timeout_ms)
+{
+	test_config();
+	get_config()->recv_timeout = timeout_ms;
+	test_start();
+
+	// 2 s de pulsos: a mediana enche, o controle sai do failsafe e a arma passa do atraso inicial
+	for (uint8_t i = 0; i < 100; i++) test_recv_frame(drive, FRAME_US);
+	CHECK(recv_online());
+	CHECK(hal_host_output.motor_left != 0);
+	CHECK(hal_host_output.motor_right != 0);
+	CHECK(hal_host_output.esc != 0);
+
+	uint8_t ramp_ok;
+	uint32_t zero_us = failsafe_cut(&ramp_ok);
+	CHECK(ramp_ok);
+	CHECK(!recv_online());
+	if (zero_us > FAILSAFE_BUDGET_US(timeout_ms))
+		test_fail(__FILE__, __LINE__, "saídas em zero depois de %u us com timeout de %u ms (orçamento de %lu us)",
+			zero_us, timeout_ms, FAILSAFE_BUDGET_US(timeout_ms));
+	test_checks++;
+
+	// Continuam em zero sem pulsos
+	test_run_us(200000);
+	CHECK_EQ(output_mag(), 0);
+
+	// Os pulsos voltam: os motores são rearmados
+	for (uint8_t i = 0; i < 100; i++) test_recv_frame(drive, FRAME_US);
+	CHECK(recv_online());
+	CHECK(hal_host_output.motor_left != 0);
+}
+
+void test_failsafe()
+{
+	failsafe_run(100);
+	failsafe_run(30);
+	failsafe_run(255);
+}
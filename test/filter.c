@@ -0,0 +1,214 @@
+//
+// filter.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes dos filtros dos canais PWM (recv_filter em input.c), um por
+// canal ao mesmo tempo: o atraso num degrau, em frames do receptor, a
+// rejeição de glitches de um e de dois frames e o ruído com jitter nos
+// pulsos, comparados com o que cada filtro promete
+//
+
+#include "test.h"
+#include <stdlib.h>
+
+#define FRAME_US 20000
+#define FILTER_WARMUP_FRAMES 30
+#define FILTER_JITTER_FRAMES 100
+
+// Canal de cada filtro; o 4 fica na mediana, como o 0
+#define CH_MEDIAN 0
+#define CH_MEDIAN3_IIR 1
+#define CH_GATE_HOLD 2
+#define CH_ADAPTIVE 3
+#define FILTER_CONFIG (RECV_FILTER_MEDIAN << 2*CH_MEDIAN | RECV_FILTER_MEDIAN3_IIR << 2*CH_MEDIAN3_IIR | \
+	RECV_FILTER_GATE_HOLD << 2*CH_GATE_HOLD | RECV_FILTER_ADAPTIVE << 2*CH_ADAPTIVE)
+
+static const char *filter_names[4] = { "mediana", "mediana3+iir", "gate", "adaptativo" };
+
+static void filter_frames(uint16_t width, uint8_t count)
+{
+	uint16_t widths[5] = { width, width, width, width, width };
+	while (count--) test_recv_frame(widths, FRAME_US);
+}
+
+// Valor que a saída tem que alcançar, em unidades de recv_get_ch()
+static int16_t filter_level(uint16_t width)
+{
+	return (2 * (int16_t)width - RECV_MID) * 11 / 32;
+}
+
+// Frames, depois do degrau de from a to us, até cada canal passar de 90% do degrau
+static void filter_step(uint16_t from, uint16_t to, uint8_t *latency)
+{
+	int16_t a = filter_level(from), b = filter_level(to);
+	filter_frames(from, FILTER_WARMUP_FRAMES);
+	memset(latency, 0xFF, 4);
+	for (uint8_t f = 1; f <= 10; f++)
+	{
+		filter_frames(to, 1);
+		for (uint8_t ch = 0; ch < 4; ch++)
+			if (latency[ch] == 0xFF && (recv_get_ch(ch) - a) * 10 >= (b - a) * 9) latency[ch] = f;
+	}
+}
+
+// Maior desvio da saída de cada canal com length frames de glitch no meio do neutro
+static void filter_glitch(uint16_t glitch, uint8_t length, int16_t *deviation)
+{
+	int16_t level = filter_level(1500);
+	filter_frames(1500, FILTER_WARMUP_FRAMES);
+	memset(deviation, 0, 4 * sizeof(int16_t));
+	for (uint8_t f = 0; f < length + 10; f++)
+	{
+		filter_frames(f < length ? glitch : 1500, 1);
+		for (uint8_t ch = 0; ch < 4; ch++)
+			if (abs(recv_get_ch(ch) - level) > deviation[ch]) deviation[ch] = abs(recv_get_ch(ch) - level);
+	}
+}
+
+// Pico a pico de cada canal com jitter de +-jitter_us em todos os pulsos
+static void filter_noise(uint8_t jitter_us, int16_t *ptp)
+{
+	int16_t lo[4], hi[4];
+	filter_frames(1500, FILTER_WARMUP_FRAMES);
+	for (uint8_t ch = 0; ch < 4; ch++) lo[ch] = hi[ch] = recv_get_ch(ch);
+	for (uint8_t f = 0; f < FILTER_JITTER_FRAMES; f++)
+	{
+		uint16_t widths[5];
+		for (uint8_t ch = 0; ch < 5; ch++) widths[ch] = 1500 + rand() % (2 * jitter_us + 1) - jitter_us;
+		test_recv_frame(widths, FRAME_US);
+		for (uint8_t ch = 0; ch < 4; ch++)
+		{
+			int16_t v = recv_get_ch(ch);
+			if (v < lo[ch]) lo[ch] = v;
+			if (v > hi[ch]) hi[ch] = v;
+		}
+	}
+	for (uint8_t ch = 0; ch < 4; ch++) ptp[ch] = hi[ch] - lo[ch];
+}
+
+static void filter_report(const char *what, const int16_t *v, const int16_t *max)
+{
+	for (uint8_t ch = 0; ch < 4; ch++)
+	{
+		if (v[ch] > max[ch])
+			test_fail(__FILE__, __LINE__, "%s, %s: %d (máximo %d)", what, filter_names[ch], v[ch], max[ch]);
+		test_checks++;
+	}
+}
+
+// O gate não tem janela: sem nenhum outro filtro, só os frames dos encoders ficam na arena
+static void test_gate_arena()
+{
+	test_config();
+	get_config()->recv_filter = 0x2AA;
+	input_init();
+	CHECK_EQ(arena_used(), 2 * CFG_ENC_FRAMES * sizeof(uint16_t));
+}
+
+// Sem espaço na arena para as janelas, os canais ficam no gate e continuam
+// funcionando; sem espaço nem para os frames dos encoders, o robô não anda
+static void test_arena_full()
+{
+	static const uint16_t drive[5] = { 1500, 1800, 1000, 1500, 1800 };
+
+	test_config();
+	get_config()->recv_filter = FILTER_CONFIG;
+	arena_alloc(1024 - 2 * CFG_ENC_FRAMES * sizeof(uint16_t) - 8);
+	test_start();
+	for (uint8_t i = 0; i < 100; i++) test_recv_frame(drive, FRAME_US);
+	CHECK(recv_online());
+	CHECK_EQ(recv_get_ch(1), filter_level(1800));
+	CHECK(hal_host_output.motor_left != 0);
+
+	test_config();
+	arena_alloc(1024 - CFG_ENC_FRAMES * sizeof(uint16_t));
+	test_start();
+	for (uint8_t i = 0; i < 100; i++) test_recv_frame(drive, FRAME_US);
+	CHECK(!recv_online());
+	CHECK_EQ(hal_host_output.motor_left, 0);
+	CHECK_EQ(hal_host_output.esc, 0);
+}
+
+// Estatística de jitter do canal 0, em us
+static double filter_jitter_us()
+{
+	return recv_get_stats()[0].jitter / 32.0;
+}
+
+// O jitter mede o ruído dos pulsos, e não o movimento do stick, e não estoura
+// com saltos grandes entre frames
+static void test_link_jitter()
+{
+	uint16_t widths[5];
+
+	test_config();
+	test_start();
+	filter_frames(1500, 100);
+	CHECK(filter_jitter_us() < 0.5); 
+
+	// +-8 us uniforme: o desvio médio é de uns 4 us
+	for (uint8_t f = 0; f < 200; f++)
+	{
+		for (uint8_t ch = 0; ch < 5; ch++) widths[ch] = 1500 + rand() % 17 - 8;
+		test_recv_frame(widths, FRAME_US);
+	}
+	CHECK_RANGE(filter_jitter_us() * 10, 25, 70);
+
+	// Rampa de 5 us por frame sem ruído: a diferença entre frames seria de 5 us
+	filter_frames(1100, 100);
+	for (uint16_t w = 1100; w <= 1900; w += 5) filter_frames(w, 1);
+	CHECK(filter_jitter_us() < 1.5);
+
+	// Saltos de 1130 us a cada frame, quase a faixa toda do gate: a média não dá a volta
+	for (uint8_t f = 0; f < 100; f++) filter_frames(f % 2 ? 970 : 2100, 1);
+	CHECK(filter_jitter_us() > 400);
+}
+
+void test_filter()
+{
+	test_gate_arena();
+	test_arena_full();
+	test_link_jitter();
+
+	test_config();
+	get_config()->recv_filter = FILTER_CONFIG;
+	test_start();
+	srand(5);
+
+	// Atraso até 90% do degrau grande (600 ticks), em frames: a mediana de 5
+	// precisa de 3 amostras novas; a de 3 precisa de 2, e o IIR de alfa 1/2 mais
+	// 3 frames; o gate confirma em 2; o adaptativo segue a mediana de 3 nos degraus
+	// grandes
+	uint8_t latency[4];
+	int16_t latency16[4];
+	static const int16_t latency_max[4] = { 3, 5, 2, 2 };
+	filter_step(1500, 1800, latency);
+	for (uint8_t ch = 0; ch < 4; ch++) latency16[ch] = latency[ch];
+	filter_report("atraso no degrau", latency16, latency_max);
+	// O gate e o adaptativo são os mais rápidos, a mediana com IIR o mais lento
+	CHECK(latency[CH_GATE_HOLD] < latency[CH_MEDIAN]);
+	CHECK(latency[CH_ADAPTIVE] < latency[CH_MEDIAN]);
+	CHECK(latency[CH_MEDIAN3_IIR] >= latency[CH_MEDIAN]);
+
+	// Um frame de glitch não passa por nenhum filtro
+	int16_t deviation[4];
+	static const int16_t glitch1_max[4] = { 0, 0, 0, 0 };
+	filter_glitch(1900, 1, deviation);
+	filter_report("glitch de 1 frame", deviation, glitch1_max);
+
+	// Dois frames: só a mediana de 5 ainda rejeita; o gate confirma o salto
+	static const int16_t glitch2_max[4] = { 0, 0x7FFF, 0x7FFF, 0x7FFF };
+	filter_glitch(1900, 2, deviation);
+	filter_report("glitch de 2 frames", deviation, glitch2_max);
+	CHECK(deviation[CH_GATE_HOLD] > 0);
+
+	// Com jitter, o IIR suaviza (o adaptativo mais que todos), e o gate passa tudo
+	int16_t ptp[4];
+	filter_noise(8, ptp);
+	CHECK(ptp[CH_ADAPTIVE] < ptp[CH_GATE_HOLD]);
+	CHECK(ptp[CH_MEDIAN3_IIR] < ptp[CH_GATE_HOLD]);
+	CHECK(ptp[CH_ADAPTIVE] <= ptp[CH_MEDIAN3_IIR]);
+}
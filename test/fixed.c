@@ -0,0 +1,259 @@
+//
+// fixed.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes da aritmética fixed-point (fixed.h): FIXED_SAMPLES entradas
+// aleatórias, com os valores espalhados por todas as magnitudes e os
+// extremos do int32_t, comparadas com a conta feita em double e saturada
+// nos limites do int32_t. O double é exato aqui: os produtos têm no máximo
+// 47 bits
+//
+// O asm do q_mul48 no AVR (Q_MUL48_ASM) também é conferido: o texto dele
+// roda num interpretador das poucas instruções que ele usa, com os
+// operandos em registradores fixos, e o produto tem que ser o do int64_t,
+// sem mexer nas entradas e com o r1 zerado no fim. O interpretador conta
+// os ciclos de cada entrada (host/test/run fixed mostra o mínimo e o
+// máximo); não é uma medida no alvo
+//
+
+#include "test.h"
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+
+#define FIXED_SAMPLES 2000000UL
+
+enum { FIXED_ADD, FIXED_SUB, FIXED_MUL, FIXED_SCALE, FIXED_DIV_POW2, FIXED_OPS };
+static const char *fixed_names[FIXED_OPS] = { "q_add", "q_sub", "q_mul", "q_scale", "q_div_pow2" };
+
+static const int32_t fixed_edges[] = { 0, 1, -1, 255, -256, 0x10000, -0x10000, Q_MAX, Q_MIN, Q_MAX - 1, Q_MIN + 1 };
+#define NUM_EDGES (sizeof(fixed_edges) / sizeof(int32_t))
+
+static uint32_t fixed_rand32()
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+// Um quarto dos valores em toda a faixa, um quarto com uma magnitude
+// aleatória, um quarto nos extremos e um quarto perto do zero
+static int32_t fixed_value()
+{
+	switch (rand() % 4)
+	{
+		case 0: return (int32_t)fixed_rand32();
+		case 1: return (int32_t)fixed_rand32() >> (rand() % 32);
+		case 2: return fixed_edges[rand() % NUM_EDGES];
+		default: return rand() % 2001 - 1000;
+	}
+}
+
+static int16_t fixed_gain()
+{
+	switch (rand() % 3)
+	{
+		case 0: return (int16_t)rand();
+		case 1: return (int16_t)fixed_edges[rand() % NUM_EDGES];
+		default: return rand() % 1025 - 512;
+	}
+}
+
+static int32_t fixed_saturate(double v)
+{
+	if (v > Q_MAX) return Q_MAX;
+	if (v < Q_MIN) return Q_MIN;
+	return (int32_t)v;
+}
+
+// Registradores dos operandos no interpretador
+#define AVR_L 10
+#define AVR_H 14
+#define AVR_Z 16
+#define AVR_K 18
+#define AVR_X 20
+#define AVR_MAX_INSTRS 64
+
+typedef struct
+{
+	char op[5];
+	uint8_t a, b;   // registradores, ou o bit do sbrs
+	int8_t label;   // rótulo definido na linha (-1 para nenhum)
+	int8_t target;  // rótulo do rjmp
+} avr_instr;
+
+static avr_instr avr_code[AVR_MAX_INSTRS];
+static uint8_t avr_length;
+
+// %A[k], %[z], r0, __zero_reg__ ou um número
+static uint8_t avr_operand(const char *s)
+{
+	while (*s == ' ') s++;
+	if (s[0] == 'r' && isdigit((unsigned char)s[1])) return atoi(s + 1);
+	if (!strncmp(s, "__zero_reg__", 12)) return 1;
+	if (s[0] != '%') return atoi(s);
+	uint8_t byte = s[1] == '[' ? 0 : s[1] - 'A';
+	const char *name = strchr(s, '[') + 1;
+	switch (*name)
+	{
+		case 'l': return AVR_L + byte;
+		case 'h': return AVR_H + byte;
+		case 'z': return AVR_Z + byte;
+		case 'k': return AVR_K + byte;
+		default: return AVR_X + byte;
+	}
+}
+
+// Quebra o texto do asm em instruções; os rótulos ficam na instrução seguinte
+static void avr_parse(const char *text)
+{
+	char line[32];
+	int8_t label = -1;
+	avr_length = 0;
+	while (*text)
+	{
+		size_t n = strcspn(text, "\n");
+		snprintf(line, sizeof(line), "%.*s", (int)n, text);
+		text += n;
+		while (*text == '\n' || *text == '\t') text++;
+
+		if (line[0] && line[strlen(line) - 1] == ':') { label = atoi(line); continue; }
+		avr_instr *ins = &avr_code[avr_length++];
+		char *args = strchr(line, ' ');
+		memset(ins, 0, sizeof(avr_instr));
+		snprintf(ins->op, sizeof(ins->op), "%.*s", (int)(args ? args - line : (long)strlen(line)), line);
+		ins->label = label;
+		ins->target = -1;
+		label = -1;
+		if (!args) continue;
+		if (!strcmp(ins->op, "rjmp")) { ins->target = atoi(args); continue; }
+		ins->a = avr_operand(args);
+		if (strchr(args, ',')) ins->b = avr_operand(strchr(args, ',') + 1);
+	}
+}
+
+// Roda o asm com k e x nos registradores dos operandos; retorna os ciclos, ou 0
+// com uma instrução desconhecida
+static uint16_t avr_run(int16_t k, int32_t x, uint8_t *reg)
+{
+	uint8_t carry = 0;
+	uint16_t cycles = 0;
+
+	memset(reg, 0xA5, 32);
+	reg[AVR_K] = k; reg[AVR_K+1] = (uint16_t)k >> 8;
+	for (uint8_t i = 0; i < 4; i++) reg[AVR_X+i] = (uint32_t)x >> 8*i;
+
+	for (uint8_t pc = 0; pc < avr_length; )
+	{
+		const avr_instr *ins = &avr_code[pc++];
+		uint8_t *d = &reg[ins->a], r = reg[ins->b];
+		int16_t v;
+		cycles++;
+		if (!strcmp(ins->op, "clr")) *d = 0;
+		else if (!strcmp(ins->op, "mov")) *d = r;
+		else if (!strcmp(ins->op, "mul"))
+		{
+			uint16_t p = *d * r;
+			reg[0] = p;
+			reg[1] = p >> 8;
+			cycles++;
+		}
+		else if (!strcmp(ins->op, "add") || !strcmp(ins->op, "adc"))
+		{
+			v = *d + r + (ins->op[2] == 'c' ? carry : 0);
+			carry = v > 0xFF;
+			*d = v;
+		}
+		else if (!strcmp(ins->op, "sub") || !strcmp(ins->op, "sbc"))
+		{
+			v = *d - r - (ins->op[2] == 'c' ? carry : 0);
+			carry = v < 0;
+			*d = v;
+		}
+		else if (!strcmp(ins->op, "sbrs"))
+		{
+			if (*d & (1 << ins->b)) { pc++; cycles++; }
+		}
+		else if (!strcmp(ins->op, "rjmp"))
+		{
+			while (pc < avr_length && avr_code[pc].label != ins->target) pc++;
+			cycles++;
+		}
+		else return 0;
+	}
+	return cycles;
+}
+
+static unsigned long fixed_errors[FIXED_OPS];
+
+static void fixed_check(uint8_t op, int32_t got, int32_t expected, long long a, long long b, int n)
+{
+	if (got == expected) return;
+	if (fixed_errors[op]++ == 0)
+		test_fail(__FILE__, __LINE__, "%s(%lld, %lld, %d) = %d (esperado %d)",
+			fixed_names[op], a, b, n, got, expected);
+}
+
+// O asm do q_mul48 contra o int64_t, nas mesmas entradas dos outros testes
+static void test_mul48_asm()
+{
+	uint8_t reg[32];
+	uint16_t min_cycles = 0xFFFF, max_cycles = 0;
+	unsigned long errors = 0;
+
+	avr_parse(Q_MUL48_ASM);
+	for (unsigned long i = 0; i < FIXED_SAMPLES / 4; i++)
+	{
+		int16_t k = i < NUM_EDGES * NUM_EDGES ? (int16_t)fixed_edges[i % NUM_EDGES] : fixed_gain();
+		int32_t x = i < NUM_EDGES * NUM_EDGES ? fixed_edges[i / NUM_EDGES] : fixed_value();
+		uint16_t cycles = avr_run(k, x, reg);
+		if (cycles < min_cycles) min_cycles = cycles;
+		if (cycles > max_cycles) max_cycles = cycles;
+
+		int64_t expected = (int64_t)k * x;
+		uint64_t got = 0;
+		for (uint8_t j = 0; j < 4; j++) got |= (uint64_t)reg[AVR_L+j] << 8*j;
+		got |= (uint64_t)reg[AVR_H] << 32 | (uint64_t)reg[AVR_H+1] << 40;
+		uint8_t inputs_kept = reg[AVR_K] == (uint8_t)k && reg[AVR_K+1] == (uint8_t)((uint16_t)k >> 8) &&
+			reg[AVR_X] == (uint8_t)x && reg[AVR_X+3] == (uint8_t)((uint32_t)x >> 24);
+		if (cycles == 0 || got != ((uint64_t)expected & 0xFFFFFFFFFFFFULL) || reg[1] != 0 || !inputs_kept)
+		{
+			if (errors++ == 0)
+				test_fail(__FILE__, __LINE__, "Q_MUL48_ASM(%d, %d) = %012llx (esperado %012llx, r1 = %u, %u ciclos)",
+					k, x, (unsigned long long)got, (unsigned long long)expected & 0xFFFFFFFFFFFFULL, reg[1], cycles);
+		}
+	}
+	test_checks++;
+	// Sem laços, o custo só varia com as duas correções de sinal
+	CHECK_RANGE(max_cycles - min_cycles, 0, 4);
+	if (test_verbose) printf("  Q_MUL48_ASM: %u instruções, de %u a %u ciclos\n", avr_length, min_cycles, max_cycles);
+}
+
+void test_fixed()
+{
+	srand(6);
+	memset(fixed_errors, 0, sizeof(fixed_errors));
+	test_mul48_asm();
+
+	for (unsigned long i = 0; i < FIXED_SAMPLES; i++)
+	{
+		int32_t a = fixed_value(), b = fixed_value();
+		int16_t k = fixed_gain();
+		uint8_t shift = 8 + rand() % 8, n = rand() % 40;
+
+		fixed_check(FIXED_ADD, q_add(a, b), fixed_saturate((double)a + b), a, b, 0);
+		fixed_check(FIXED_SUB, q_sub(a, b), fixed_saturate((double)a - b), a, b, 0);
+		fixed_check(FIXED_MUL, q_mul(k, a), fixed_saturate(floor((double)k * a / 256)), k, a, 0);
+		fixed_check(FIXED_SCALE, q_scale(k, a, shift), fixed_saturate(floor((double)k * a / (1 << shift))), k, a, shift);
+		// n de 32 para cima dá sempre 0
+		fixed_check(FIXED_DIV_POW2, q_div_pow2(a, n), fixed_saturate(trunc(a / ldexp(1, n))), a, 0, n);
+	}
+
+	for (uint8_t op = 0; op < FIXED_OPS; op++)
+	{
+		if (fixed_errors[op])
+			test_fail(__FILE__, __LINE__, "%s: %lu de %lu entradas erradas", fixed_names[op], fixed_errors[op], FIXED_SAMPLES);
+		test_checks++;
+	}
+}
@@ -0,0 +1,108 @@
+//
+// hal.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do hardware simulado (hal_host.c): a API da HAL e o tempo
+//
+
+#include "test.h"
+
+static void test_outputs()
+{
+	motor_set_power_left(5);
+	CHECK_EQ(hal_host_output.motor_left, 0);
+	motor_set_power_left(-MOTOR_MIN_POWER);
+	CHECK_EQ(hal_host_output.motor_left, -MOTOR_MIN_POWER);
+	motor_set_power_right(300);
+	CHECK_EQ(hal_host_output.motor_right, MOTOR_MAX_POWER);
+	motor_set_power_right(-300);
+	CHECK_EQ(hal_host_output.motor_right, -MOTOR_MAX_POWER);
+
+	CHECK(!(flags & ESC_AVAILABLE));
+	esc_set_power(-1000);
+	CHECK_EQ(hal_host_output.esc, -ESC_MAX_POWER);
+	CHECK(flags & ESC_AVAILABLE);
+}
+
+static void test_serial()
+{
+	uint8_t in[3] = { 1, 2, 3 }, out[3];
+	CHECK(!rx_byte_available());
+	hal_host_rx_push(in, 2);
+	CHECK(!rx_data(out, 3)); // os 3 bytes ainda não chegaram
+	hal_host_rx_push(in + 2, 1);
+	CHECK(rx_data(out, 3));
+	CHECK(!memcmp(in, out, 3));
+
+	tx_data(in, 3);
+	CHECK_EQ(hal_host_tx_pop(out, 3), 3);
+	CHECK(!memcmp(in, out, 3));
+	CHECK_EQ(hal_host_tx_pop(out, 3), 0);
+}
+
+static void test_eeprom_arena()
+{
+	// A EEPROM começa apagada, então vale a configuração padrão
+	CHECK_EQ(get_config()->control_period, 8192);
+	CHECK_EQ(get_config()->recv_samples, 5);
+
+	void *a = arena_alloc(100);
+	CHECK(a != 0);
+	CHECK_EQ(arena_used(), 100);
+	CHECK(arena_alloc(2000) == 0);
+	hal_host_arena_reset();
+	CHECK_EQ(arena_used(), 0);
+	CHECK(arena_alloc(100) == a);
+}
+
+static void test_twi()
+{
+	uint8_t regs[256] = { 0 };
+	uint8_t cmd[3] = { 5, 0x34, 0x12 }, ptr = 5, out[2] = { 0xAA, 0xAA };
+
+	twi_init();
+	hal_host_twi_attach(0x40, regs);
+
+	CHECK(twi_cmd_ready(twi_write(0x40, cmd, 3)));
+	CHECK_EQ(regs[5], 0x34);
+	CHECK_EQ(regs[6], 0x12);
+
+	twi_write(0x40, &ptr, 1);
+	CHECK(twi_cmd_ready(twi_read(0x40, out, 2)));
+	CHECK_EQ(out[0], 0x34);
+	CHECK_EQ(out[1], 0x12);
+
+	// Sem dispositivo no endereço, nada é lido
+	out[0] = 0xAA;
+	twi_read(0x41, out, 1);
+	CHECK_EQ(out[0], 0xAA);
+}
+
+static void test_time()
+{
+	test_start();
+
+	uint32_t t0 = clock_now_us();
+	hal_host_run(2 * 5000);
+	CHECK_EQ(clock_now_us() - t0, 5000);
+
+	// O frame (SCHED_FRAME) é liberado a cada 8 overflows do Timer1, 8192 us
+	sched_stats_struct stats[SCHED_NUM_TASKS];
+	test_run_us(3 * 8192);
+	sched_get_stats(stats);
+	CHECK_RANGE(stats[SCHED_FRAME].releases, 3, 4);
+	CHECK_RANGE(stats[SCHED_CONTROL].releases, 3, 4);
+}
+
+void test_hal()
+{
+	test_config();
+	test_outputs();
+	test_serial();
+	test_eeprom_arena();
+	test_twi();
+	test_time();
+}
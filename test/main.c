@@ -0,0 +1,180 @@
+//
+// main.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo é o executor dos testes do build do computador: make
+// host-test roda todos, e host/test/run <teste> roda só um, mostrando as
+// medidas dele (test_verbose). Cada teste roda num processo novo, e o
+// executor falha se algum falhar
+//
+
+#include "test.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define RECV_GAP_US 20
+#define RECV_ESC_START_US 10000
+
+typedef struct
+{
+	const char *name;
+	void (*run)();
+} test_case;
+
+static const test_case tests[] =
+{
+	{ "hal", test_hal },
+	{ "config", test_config_eeprom },
+	{ "median", test_median },
+	{ "clock", test_clock },
+	{ "capture", test_capture },
+	{ "enc", test_enc },
+	{ "failsafe", test_failsafe },
+	{ "rcbus", test_rcbus },
+	{ "ppm", test_ppm },
+	{ "filter", test_filter },
+	{ "fixed", test_fixed },
+};
+#define NUM_TESTS (sizeof(tests) / sizeof(test_case))
+
+// Código de saída de um teste que terminou com verificações falhando
+#define TEST_EXIT_FAILED 3
+
+unsigned long test_checks = 0, test_failures = 0;
+uint8_t test_verbose = 0;
+
+void test_fail(const char *file, int line, const char *fmt, ...)
+{
+	va_list args;
+	test_failures++;
+	printf("  %s:%d: ", file, line);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+// As tarefas do main()
+static const sched_task tasks[SCHED_NUM_TASKS] =
+{
+	{ control_task, 500 },
+	{ frame_task, 150 },
+	{ recv_task, 300 },
+	{ telemetry_poll, 50 },
+};
+
+void test_config()
+{
+	hal_host_reset();
+	serial_init();
+	config_init();
+}
+
+void test_start()
+{
+	clock_init();
+	input_init();
+	control_init();
+	telemetry_init();
+	flags = 0;
+	sched_init();
+	load_init();
+	sei();
+}
+
+void test_run_us(uint32_t us)
+{
+	while (us--)
+	{
+		while (sched_run(tasks));
+		hal_host_run(2);
+	}
+}
+
+static void test_pin(uint8_t ch, uint8_t high)
+{
+	if (ch < 4)
+	{
+		PINC = high ? PINC | _BV(ch) : PINC & ~_BV(ch);
+		cli(); PCINT1_vect(); sei();
+	}
+	else
+	{
+		PIND = high ? PIND | _BV(7) : PIND & ~_BV(7);
+		cli(); PCINT2_vect(); sei();
+	}
+}
+
+void test_recv_frame(const uint16_t *widths, uint32_t frame_us)
+{
+	uint32_t t = 0;
+	for (uint8_t ch = 0; ch < 5; ch++)
+	{
+		uint32_t start = ch < 4 ? t : RECV_ESC_START_US;
+		if (start > t) test_run_us(start - t);
+		t = start;
+		if (widths[ch] == 0) continue;
+		test_pin(ch, 1);
+		test_run_us(widths[ch]);
+		test_pin(ch, 0);
+		test_run_us(RECV_GAP_US);
+		t += widths[ch] + RECV_GAP_US;
+	}
+	if (frame_us > t) test_run_us(frame_us - t);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned failed = 0, ran = 0;
+	test_verbose = argc > 1;
+
+	for (uint8_t i = 0; i < NUM_TESTS; i++)
+	{
+		if (argc > 1 && strcmp(argv[1], tests[i].name)) continue;
+		ran++;
+
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			tests[i].run();
+			if (test_failures) printf("%-10s FALHOU (%lu de %lu verificações)\n", tests[i].name, test_failures, test_checks);
+			else printf("%-10s ok (%lu verificações)\n", tests[i].name, test_checks);
+			fflush(stdout);
+			_exit(test_failures ? TEST_EXIT_FAILED : 0);
+		}
+
+		// Um teste que não chegou ao fim (um sinal, ou o sanitizer) não imprimiu nada
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status))
+		{
+			printf("%-10s FALHOU (terminou com o sinal %d)\n", tests[i].name, WTERMSIG(status));
+			failed++;
+		}
+		else if (WEXITSTATUS(status) == TEST_EXIT_FAILED) failed++;
+		else if (WEXITSTATUS(status))
+		{
+			printf("%-10s FALHOU (saiu com o código %d)\n", tests[i].name, WEXITSTATUS(status));
+			failed++;
+		}
+	}
+
+	if (ran == 0)
+	{
+		fprintf(stderr, "teste desconhecido: %s\n", argv[1]);
+		return 1;
+	}
+	if (failed)
+	{
+		printf("%u de %u testes falharam\n", failed, ran);
+		return 1;
+	}
+	printf("%u de %u testes passaram\n", ran, ran);
+	return 0;
+}
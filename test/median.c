@@ -0,0 +1,200 @@
+//
+// median.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes da mediana de janela deslizante (median.c): para cada janela
+// ímpar de 1 a MEDIAN_MAX_SAMPLES, a mediana é comparada com a da janela
+// ordenada, e os heaps e os ponteiros de volta são verificados a cada
+// inserção, junto com o limite de trocas por atualização
+//
+// O benchmark conta as comparações e as trocas por atualização de cada
+// janela, contra a ordenação por inserção que o filtro usava antes (busca
+// linear da amostra mais antiga e trocas com as vizinhas). O computador não
+// conta os ciclos do AVR: o custo no alvo é o do median_insert no make
+// bench-isr. host/test/run median mostra a tabela
+//
+
+#include "test.h"
+#include <stdlib.h>
+
+#define MEDIAN_STEPS 3000
+
+extern uint32_t median_compares, median_exchanges;
+
+// Média e máximo de uma contagem por atualização
+typedef struct
+{
+	uint32_t total, max;
+} median_count;
+
+static void count_add(median_count *c, uint32_t v)
+{
+	c->total += v;
+	if (v > c->max) c->max = v;
+}
+
+// A ordenação antiga: order[] tem os índices da janela em ordem, e a amostra
+// nova anda pelas vizinhas até o lugar dela
+typedef struct
+{
+	uint16_t data[MEDIAN_MAX_SAMPLES];
+	uint8_t order[MEDIAN_MAX_SAMPLES], cur, samples;
+	uint32_t compares, exchanges;
+} sorted_window;
+
+static void sorted_init(sorted_window *s, uint8_t samples)
+{
+	memset(s, 0, sizeof(sorted_window));
+	s->samples = samples;
+	for (uint8_t j = 0; j < samples; j++) s->order[j] = j;
+}
+
+static void sorted_swap(sorted_window *s, uint8_t k, uint8_t l)
+{
+	uint8_t t = s->order[k];
+	s->order[k] = s->order[l];
+	s->order[l] = t;
+	s->exchanges++;
+}
+
+static void sorted_insert(sorted_window *s, uint16_t value)
+{
+	uint8_t k = 0;
+	s->data[s->cur] = value;
+	for (; k < s->samples; k++, s->compares++)
+		if (s->order[k] == s->cur) break;
+	while (k > 0 && (s->compares++, s->data[s->order[k]] <= s->data[s->order[k-1]]))
+		sorted_swap(s, k, k-1), k--;
+	while (k < s->samples-1 && (s->compares++, s->data[s->order[k]] >= s->data[s->order[k+1]]))
+		sorted_swap(s, k, k+1), k++;
+	if (++s->cur == s->samples) s->cur = 0;
+}
+
+static int compare_u16(const void *a, const void *b)
+{
+	return (int)*(const uint16_t*)a - (int)*(const uint16_t*)b;
+}
+
+// Os dois heaps, com a raiz comum, e os ponteiros de volta
+static uint8_t median_valid(const median_filter *m)
+{
+	for (int8_t i = 1; i <= m->half; i++)
+		if (m->data[m->heap[i]] < m->data[m->heap[i/2]]) return 0;
+	for (int8_t i = -1; i >= -m->half; i--)
+		if (m->data[m->heap[i]] > m->data[m->heap[i/2]]) return 0;
+	for (uint8_t j = 0; j < m->samples; j++)
+		if (m->heap[m->pos[j]] != j) return 0;
+	return 1;
+}
+
+// Valores: ruído em torno do centro, espículas nos extremos e repetições
+static uint16_t median_sample(uint8_t step)
+{
+	switch (rand() % 8)
+	{
+		case 0: return 0;
+		case 1: return 0xFFFF;
+		case 2: return RECV_MID;
+		case 3: return step * 37u;
+		default: return RECV_MID - 400 + rand() % 800;
+	}
+}
+
+static void test_window(uint8_t samples)
+{
+	median_filter m;
+	uint16_t window[MEDIAN_MAX_SAMPLES], sorted[MEDIAN_MAX_SAMPLES];
+	uint8_t heap_before[MEDIAN_MAX_SAMPLES];
+
+	sorted_window s;
+	median_count heap_cmp = { 0, 0 }, heap_xchg = { 0, 0 }, old_cmp = { 0, 0 }, old_xchg = { 0, 0 };
+
+	hal_host_arena_reset();
+	CHECK(median_alloc(&m, samples));
+	CHECK_EQ(arena_used(), MEDIAN_BYTES(samples));
+	median_init(&m);
+	CHECK_EQ(median_get(&m), 0);
+	memset(window, 0, sizeof(window));
+	sorted_init(&s, samples);
+
+	// Cada troca muda 2 posições do heap: no máximo uma subida e duas descidas
+	uint8_t levels = 0;
+	while ((1 << levels) < (samples + 1) / 2) levels++;
+	uint8_t max_changed = 2 * 3 * levels;
+
+	uint8_t ok = 1, bounded = 1, valid = 1;
+	for (uint16_t step = 0; step < MEDIAN_STEPS; step++)
+	{
+		uint16_t v = median_sample(step);
+		window[step % samples] = v;
+
+		memcpy(heap_before, m.heap - m.half, samples);
+		median_compares = median_exchanges = 0;
+		median_insert(&m, v);
+		count_add(&heap_cmp, median_compares);
+		count_add(&heap_xchg, median_exchanges);
+
+		s.compares = s.exchanges = 0;
+		sorted_insert(&s, v);
+		count_add(&old_cmp, s.compares);
+		count_add(&old_xchg, s.exchanges);
+		if (median_get(&m) != s.data[s.order[samples / 2]]) ok = 0;
+
+		uint8_t changed = 0;
+		for (uint8_t i = 0; i < samples; i++)
+			changed += heap_before[i] != (m.heap - m.half)[i];
+		if (changed > max_changed) bounded = 0;
+		if (!median_valid(&m)) valid = 0;
+
+		memcpy(sorted, window, sizeof(uint16_t) * samples);
+		qsort(sorted, samples, sizeof(uint16_t), compare_u16);
+		if (median_get(&m) != sorted[samples / 2]) ok = 0;
+	}
+
+	if (!ok) test_fail(__FILE__, __LINE__, "mediana errada com %u amostras", samples);
+	if (!valid) test_fail(__FILE__, __LINE__, "heap inválido com %u amostras", samples);
+	if (!bounded) test_fail(__FILE__, __LINE__, "mais de %u trocas com %u amostras", max_changed / 2, samples);
+	test_checks += 3;
+
+	// Da janela de 7 para cima os heaps fazem menos comparações, na média e no
+	// pior caso, que a ordenação antiga
+	if (samples >= 7)
+	{
+		CHECK(heap_cmp.total < old_cmp.total);
+		CHECK(heap_cmp.max < old_cmp.max);
+	}
+	if (test_verbose)
+		printf("  %2u amostras: heaps %5.1f/%2u comparações %4.1f/%2u trocas, "
+			"ordenação %5.1f/%2u comparações %4.1f/%2u trocas\n", samples,
+			(double)heap_cmp.total / MEDIAN_STEPS, heap_cmp.max, (double)heap_xchg.total / MEDIAN_STEPS, heap_xchg.max,
+			(double)old_cmp.total / MEDIAN_STEPS, old_cmp.max, (double)old_xchg.total / MEDIAN_STEPS, old_xchg.max);
+
+	// median_init() volta ao zero com a janela cheia
+	median_init(&m);
+	CHECK_EQ(median_get(&m), 0);
+	CHECK(median_valid(&m));
+}
+
+void test_median()
+{
+	median_filter m;
+
+	test_config();
+	srand(1);
+
+	// Janelas pares e maiores que MEDIAN_MAX_SAMPLES não são aceitas, e não
+	// gastam a arena
+	hal_host_arena_reset();
+	CHECK(!median_alloc(&m, 0));
+	CHECK(!median_alloc(&m, 4));
+	CHECK(!median_alloc(&m, MEDIAN_MAX_SAMPLES + 1));
+	CHECK(!median_alloc(&m, MEDIAN_MAX_SAMPLES + 2));
+	CHECK_EQ(arena_used(), 0);
+
+	if (test_verbose) printf("  comparações e trocas por atualização (média/máximo)\n");
+	for (uint8_t samples = 1; samples <= MEDIAN_MAX_SAMPLES; samples += 2)
+		test_window(samples);
+}
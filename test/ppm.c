@@ -0,0 +1,157 @@
+//
+// ppm.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do decodificador PPM (input.c, recv_mode = RECV_MODE_PPM): trens
+// de 8 canais no PC0, com jitter em cada subida. Todo frame tem que chegar,
+// com o erro limitado pelo jitter, e os frames com um glitch, um canal fora
+// da faixa ou canais de menos têm que ser descartados inteiros
+//
+
+#include "test.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define PPM_FRAME_US 22500
+#define PPM_PULSE_US 300
+#define PPM_CHANNELS 8
+#define PPM_FRAMES 100
+
+static uint32_t ppm_now;
+
+static void ppm_until(uint32_t t)
+{
+	if (t > ppm_now) test_run_us(t - ppm_now);
+	ppm_now = t;
+}
+
+// Uma subida no instante t e a descida PPM_PULSE_US depois
+static void ppm_edge(uint32_t t)
+{
+	ppm_until(t);
+	PINC |= B1;
+	cli(); PCINT1_vect(); sei();
+	ppm_until(t + PPM_PULSE_US);
+	PINC &= ~B1;
+	cli(); PCINT1_vect(); sei();
+}
+
+static int16_t ppm_jitter(uint8_t jitter_us)
+{
+	return jitter_us ? rand() % (2 * jitter_us + 1) - jitter_us : 0;
+}
+
+// Os canais 0 a 4 batem com as larguras em us, com a tolerância em unidades de recv_get_ch()
+static uint8_t ppm_matches(const uint16_t *widths, double tol)
+{
+	for (uint8_t ch = 0; ch < 5; ch++)
+	{
+		double exact = (2.0 * widths[ch] - 3000) * 11 / 32;
+		if (fabs(recv_get_ch(ch) - exact) > tol) return 0;
+	}
+	return 1;
+}
+
+// Manda um frame com n canais; glitch_at (>= 0) põe uma subida a mais 200 us
+// antes do fim desse canal
+static void ppm_frame(uint32_t t, const uint16_t *widths, uint8_t n, int8_t glitch_at, uint8_t jitter_us)
+{
+	for (uint8_t i = 0; i <= n; i++)
+	{
+		ppm_edge(t + ppm_jitter(jitter_us));
+		if (i == glitch_at) ppm_edge(t + widths[i] - 200);
+		if (i < n) t += widths[i];
+	}
+}
+
+// Larguras dentro de RECV_MIN..RECV_MAX (1124 a 1876 us), que não são cortadas
+static void ppm_widths(uint16_t *widths, uint8_t k)
+{
+	for (uint8_t i = 0; i < PPM_CHANNELS; i++)
+		widths[i] = 1150 + (k * 97 + i * 131) % 701;
+}
+
+static void test_jitter(uint8_t jitter_us)
+{
+	uint16_t widths[PPM_CHANNELS], prev[PPM_CHANNELS];
+	// Cada largura tem o jitter de duas subidas: 2 us de largura são 11/16 na escala
+	double tol = 2 * jitter_us * 11.0 / 16 + 1;
+	uint16_t matched = 0, online = 0;
+
+	for (uint8_t k = 0; k <= PPM_FRAMES; k++)
+	{
+		uint32_t t = ppm_now + 1000;
+		ppm_widths(widths, k);
+
+		// O frame anterior sai no sync, que termina na primeira subida deste
+		ppm_edge(t + ppm_jitter(jitter_us));
+		ppm_until(t + 1000);
+		if (k > 0)
+		{
+			matched += ppm_matches(prev, tol);
+			online += recv_online();
+		}
+
+		ppm_frame(t + widths[0], widths + 1, PPM_CHANNELS - 1, -1, jitter_us);
+		memcpy(prev, widths, sizeof(widths));
+		ppm_until(t + PPM_FRAME_US - 1000);
+	}
+
+	if (matched != PPM_FRAMES || online != PPM_FRAMES)
+		test_fail(__FILE__, __LINE__, "jitter de %u us: %u de %u frames certos, %u online",
+			jitter_us, matched, PPM_FRAMES, online);
+	test_checks++;
+}
+
+// Um frame bom, o ruim e outro bom: na saída, o primeiro continua até o
+// terceiro chegar, e o ruim nunca aparece
+static void test_bad_frame(const char *name, uint8_t n, int8_t glitch_at, uint16_t long_width)
+{
+	uint16_t good[PPM_CHANNELS], bad[PPM_CHANNELS], next[PPM_CHANNELS];
+	uint32_t t = ppm_now + 5000;
+
+	ppm_widths(good, 1);
+	ppm_widths(bad, 2);
+	ppm_widths(next, 3);
+	if (long_width) bad[3] = long_width;
+
+	ppm_frame(t, good, PPM_CHANNELS, -1, 0);
+	t += PPM_FRAME_US;
+	ppm_frame(t, bad, n, glitch_at, 0);
+	uint8_t ok = 1;
+	t += PPM_FRAME_US;
+	ppm_frame(t, next, PPM_CHANNELS, -1, 0);
+	ppm_until(t + PPM_FRAME_US - 1000);
+	if (!ppm_matches(good, 1)) ok = 0;
+	ppm_edge(t + PPM_FRAME_US);
+	ppm_until(t + PPM_FRAME_US + 1000);
+	if (!ppm_matches(next, 1)) ok = 0;
+
+	if (!ok) test_fail(__FILE__, __LINE__, "frame com %s", name);
+	test_checks++;
+}
+
+void test_ppm()
+{
+	test_config();
+	get_config()->recv_mode = RECV_MODE_PPM;
+	test_start();
+	srand(4);
+	ppm_now = 0;
+
+	// O decodificador só começa depois do primeiro sync
+	ppm_edge(1000);
+	ppm_until(5000);
+
+	test_jitter(0);
+	test_jitter(5);
+	test_jitter(20);
+	test_jitter(60);
+
+	test_bad_frame("glitch", PPM_CHANNELS, 2, 0);
+	test_bad_frame("canal longo", PPM_CHANNELS, -1, 2400);
+	test_bad_frame("4 canais", 4, -1, 0);
+}
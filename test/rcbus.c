@@ -0,0 +1,209 @@
+//
+// rcbus.c
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Testes do parser dos receptores seriais (rcbus.c), com sequências de
+// bytes entregues ao USART_RX_vect no ritmo do baud rate: frames limpos,
+// erros de recepção no meio de um frame, o ressincronismo do SBUS num
+// 0x0F dentro dos canais, o 0x20 perdido antes de um frame iBUS, o
+// checksum e o failsafe
+//
+
+#include "test.h"
+
+#define SBUS_BYTE_US 120 // 12 bits a 100000 baud
+#define IBUS_BYTE_US 87  // 10 bits a 115200 baud
+#define FRAME_GAP_US 4000
+
+// Canais de um frame SBUS gravado com os sticks parados: os bytes 3 e 4 são
+// 0x00 e o 5 é 0x0F, então, desalinhado em 5, ele tem cabeçalho e rodapé
+// válidos, e o failsafe desligado
+static const uint8_t sbus_recorded[22] =
+{
+	0xE0, 0x03, 0x00, 0x00, 0x0F, 0x7C, 0xE0, 0x03, 0x1F, 0xF8, 0xC0,
+	0x07, 0x3E, 0xF0, 0x81, 0x0F, 0x7C, 0xE0, 0x03, 0x1F, 0xF8, 0x00,
+};
+
+static void rcbus_byte(uint8_t byte, uint8_t error, uint16_t byte_us)
+{
+	hal_host_run(2 * byte_us);
+	UDR0 = byte;
+	UCSR0A = error ? _BV(FE0) : 0;
+	cli(); USART_RX_vect(); sei();
+}
+
+// Manda n bytes, com um erro de frame no byte error_at (-1 para nenhum), e o
+// silêncio até o próximo frame
+static void rcbus_send(const uint8_t *bytes, uint8_t n, int8_t error_at, uint16_t byte_us)
+{
+	for (uint8_t i = 0; i < n; i++) rcbus_byte(bytes[i], i == error_at, byte_us);
+	hal_host_run(2 * FRAME_GAP_US);
+}
+
+static void sbus_frame(uint8_t *frame, const uint8_t *payload, uint8_t flags)
+{
+	frame[0] = 0x0F;
+	memcpy(frame + 1, payload, 22);
+	frame[23] = flags;
+	frame[24] = 0x00;
+}
+
+// 16 canais de 11 bits, LSB primeiro, na escala dos pulsos
+static void sbus_expected(const uint8_t *payload, uint16_t *channels)
+{
+	for (uint8_t ch = 0; ch < 16; ch++)
+	{
+		uint16_t v = 0;
+		for (uint8_t b = 0; b < 11; b++)
+		{
+			uint8_t bit = ch * 11 + b;
+			if (payload[bit / 8] & _BV(bit % 8)) v |= 1 << b;
+		}
+		channels[ch] = RECV_MID + ((int16_t)v - 992) * 5 / 4;
+	}
+}
+
+// Lê o que chegou: o frame tem que ter vindo com os canais esperados (expected
+// 0 para nenhum frame válido)
+static uint8_t rcbus_check(uint8_t n, const uint16_t *expected)
+{
+	uint16_t channels[RCBUS_MAX_CHANNELS];
+	uint8_t got = rcbus_read(channels);
+	if (!expected) return got == 0;
+	return got == n && !memcmp(channels, expected, n * sizeof(uint16_t));
+}
+
+static void test_sbus()
+{
+	uint8_t frame[25], payload[22];
+	uint16_t expected[16];
+	uint8_t ok = 1;
+
+	// Um frame que já estava no meio quando a USART foi ligada não vale
+	rcbus_init(RECV_MODE_SBUS);
+	hal_host_run(2 * FRAME_GAP_US);
+
+	// Frames limpos, com os canais mudando
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		for (uint8_t j = 0; j < 22; j++) payload[j] = i * 37 + j * 11;
+		sbus_frame(frame, payload, 0);
+		sbus_expected(payload, expected);
+		rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+		if (!rcbus_check(16, expected)) ok = 0;
+	}
+	CHECK(ok);
+
+	// Erro no byte 2: o parser não pode travar no 0x0F do byte 5
+	sbus_frame(frame, sbus_recorded, 0);
+	sbus_expected(sbus_recorded, expected);
+	rcbus_send(frame, 25, 2, SBUS_BYTE_US);
+	CHECK(rcbus_check(16, 0));
+	ok = 1;
+	for (uint8_t i = 0; i < 10; i++)
+	{
+		rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+		if (!rcbus_check(16, expected)) ok = 0;
+	}
+	CHECK(ok);
+
+	// O mesmo frame gravado sem intervalo nenhum depois de um erro: nada vale até
+	// aparecer um silêncio
+	rcbus_byte(0x55, 1, SBUS_BYTE_US);
+	for (uint8_t i = 5; i < 25; i++) rcbus_byte(frame[i], 0, SBUS_BYTE_US);
+	for (uint8_t i = 0; i < 25; i++) rcbus_byte(frame[i], 0, SBUS_BYTE_US);
+	hal_host_run(2 * FRAME_GAP_US);
+	CHECK(rcbus_check(16, 0));
+	rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+	CHECK(rcbus_check(16, expected));
+
+	// Failsafe do receptor e rodapé errado
+	sbus_frame(frame, sbus_recorded, 0x08);
+	rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+	CHECK(rcbus_check(16, 0));
+	sbus_frame(frame, sbus_recorded, 0);
+	frame[24] = 0x55;
+	rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+	CHECK(rcbus_check(16, 0));
+
+	// O buffer enche sem o parser ler (3 frames): o próximo frame ainda vale
+	frame[24] = 0x00;
+	for (uint8_t i = 0; i < 3; i++) rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+	rcbus_check(16, 0);
+	rcbus_send(frame, 25, -1, SBUS_BYTE_US);
+	CHECK(rcbus_check(16, expected));
+}
+
+static void ibus_frame(uint8_t *frame, const uint16_t *us)
+{
+	uint16_t sum = 0xFFFF;
+	frame[0] = 0x20;
+	frame[1] = 0x40;
+	for (uint8_t ch = 0; ch < 14; ch++)
+	{
+		frame[2+2*ch] = us[ch] & 0xFF;
+		frame[3+2*ch] = us[ch] >> 8;
+	}
+	for (uint8_t i = 0; i < 30; i++) sum -= frame[i];
+	frame[30] = sum & 0xFF;
+	frame[31] = sum >> 8;
+}
+
+static void test_ibus()
+{
+	uint8_t frame[33];
+	uint16_t us[14], expected[14];
+	uint8_t ok = 1;
+
+	rcbus_init(RECV_MODE_IBUS);
+	hal_host_run(2 * FRAME_GAP_US);
+
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		for (uint8_t ch = 0; ch < 14; ch++)
+		{
+			us[ch] = 1000 + (i * 53 + ch * 71) % 1001;
+			expected[ch] = RECV_MID + ((int16_t)us[ch] - 1500) * 2;
+		}
+		ibus_frame(frame, us);
+		rcbus_send(frame, 32, -1, IBUS_BYTE_US);
+		if (!rcbus_check(14, expected)) ok = 0;
+	}
+	CHECK(ok);
+
+	// Um 0x20 perdido logo antes do frame: 20 20 40 ...
+	memmove(frame + 1, frame, 32);
+	frame[0] = 0x20;
+	rcbus_send(frame, 33, -1, IBUS_BYTE_US);
+	CHECK(rcbus_check(14, expected));
+	memmove(frame, frame + 1, 32);
+
+	// Erro no meio de um frame, e o próximo chega inteiro
+	rcbus_send(frame, 32, 10, IBUS_BYTE_US);
+	CHECK(rcbus_check(14, 0));
+	rcbus_send(frame, 32, -1, IBUS_BYTE_US);
+	CHECK(rcbus_check(14, expected));
+
+	// Checksum errado
+	frame[5] ^= 1;
+	rcbus_send(frame, 32, -1, IBUS_BYTE_US);
+	CHECK(rcbus_check(14, 0));
+	frame[5] ^= 1;
+
+	// Um frame cortado pela metade e o seguinte, separados pelo silêncio
+	rcbus_send(frame, 16, -1, IBUS_BYTE_US);
+	rcbus_send(frame, 32, -1, IBUS_BYTE_US);
+	CHECK(rcbus_check(14, expected));
+}
+
+void test_rcbus()
+{
+	test_config();
+	clock_init();
+	sei();
+	test_sbus();
+	test_ibus();
+}
@@ -0,0 +1,77 @@
+//
+// test.h
+// Copyright (c) 2017 João Baptista de Paula e Silva
+// Este arquivo está sob a licença MIT
+//
+
+//
+// Este arquivo tem as macros e as funções comuns dos testes do build
+// do computador (make host-test). Cada arquivo daqui testa um módulo,
+// numa função listada em tests[] (test/main.c), que roda num processo
+// novo: o estado dos módulos sempre começa zerado
+//
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "../default.h"
+#include <stdio.h>
+
+extern unsigned long test_checks, test_failures;
+// Ligado quando o teste roda sozinho (host/test/run <teste>): os testes com
+// benchmark mostram as tabelas deles
+extern uint8_t test_verbose;
+void test_fail(const char *file, int line, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define CHECK(cond) do                                                   \
+{                                                                        \
+	test_checks++;                                                       \
+	if (!(cond)) test_fail(__FILE__, __LINE__, "%s", #cond);             \
+} while (0)
+
+#define CHECK_EQ(a, b) do                                                \
+{                                                                        \
+	long long check_a = (a), check_b = (b);                              \
+	test_checks++;                                                       \
+	if (check_a != check_b)                                              \
+		test_fail(__FILE__, __LINE__, "%s == %s (%lld != %lld)",         \
+			#a, #b, check_a, check_b);                                   \
+} while (0)
+
+// lo <= v <= hi
+#define CHECK_RANGE(v, lo, hi) do                                        \
+{                                                                        \
+	long long check_v = (v), check_lo = (lo), check_hi = (hi);           \
+	test_checks++;                                                       \
+	if (check_v < check_lo || check_v > check_hi)                        \
+		test_fail(__FILE__, __LINE__, "%s em [%lld, %lld] (%lld)",       \
+			#v, check_lo, check_hi, check_v);                            \
+} while (0)
+
+// A inicialização do main(), em duas partes: test_config() zera o hardware
+// simulado e carrega a configuração padrão (a EEPROM começa apagada), que o
+// teste pode mudar antes de test_start() ligar os módulos e os interrupts
+void test_config();
+void test_start();
+
+// Avança o tempo em us, rodando as tarefas liberadas como o loop do main()
+void test_run_us(uint32_t us);
+
+// Um frame do receptor PWM: os canais 0 a 3 em sequência no PORTC e o 4 no PD7,
+// com as larguras em us (0 não manda o pulso), e o resto dos frame_us sem pulsos
+void test_recv_frame(const uint16_t *widths, uint32_t frame_us);
+
+// Testes de cada módulo
+void test_hal();
+void test_config_eeprom();
+void test_median();
+void test_clock();
+void test_capture();
+void test_enc();
+void test_failsafe();
+void test_rcbus();
+void test_ppm();
+void test_filter();
+void test_fixed();
+
+#endif